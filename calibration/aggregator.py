@@ -0,0 +1,465 @@
+"""
+Multi-device aggregator for plates with several Picos.
+
+Opens every Pico at once (one pico_stream reader thread per port, binary
+format) and maps each device's clock onto the PC clock. All samples are
+merged into one time-ordered stream, served on a local TCP socket, so any
+number of processes can subscribe without owning a serial port:
+
+    python aggregator.py COM4 COM5 COM6
+
+    from aggregator import AggregatorClient
+    with AggregatorClient() as client:
+        for samples in client:          # arrays of AGG_DTYPE records
+            print(samples['t'], samples['device'], samples['z_mT'])
+
+Clock sync: every binary frame carries the device time, and pico_stream adds
+the PC time at which its read completed. Their difference is the clock offset
+plus a USB delay that is never negative. The smallest difference in each
+SYNC_WINDOW_S window is the sample that waited least, so those minima trace
+the offset. A line fitted through the last SYNC_HISTORY_S of them, then
+lowered onto the lowest one, gives the offset and drift (ppm) of every
+device. Aligned times are PC time.time() seconds, accurate to the USB
+latency floor (about 1 ms). A device that restarts (its clock jumps back)
+is re-synchronised from scratch.
+
+Merging holds samples for MERGE_DELAY_S, so slower ports catch up. It then
+sends them in time order. A sample that still arrives later than that
+goes out as soon as it is seen and is counted as late.
+
+Protocol: on connect the server sends one JSON line with the record dtype
+and the device list, followed by a plain stream of little-endian records.
+A subscriber that falls CLIENT_QUEUE_CHUNKS sends behind is disconnected
+rather than stalling the others.
+"""
+
+import argparse
+import collections
+import json
+import queue
+import socket
+import threading
+import time
+
+import numpy as np
+import serial
+from pico_stream import PicoStream, FRAME_TYPE_SAMPLE
+from recorder import Recorder
+
+# ========================================
+# AGGREGATOR CONFIGURATION
+# ========================================
+SERIAL_PORTS = ['COM4']     # One entry per Pico, or pass the ports on the command line
+BAUD_RATE = 115200
+Z_AXIS_KEYWORD = "Z-axis"
+AGG_HOST = '127.0.0.1'      # Local subscribers only
+AGG_PORT = 5757
+
+POLL_S = 0.01               # Merge tick
+MERGE_DELAY_S = 0.1         # Reorder window, above the USB batching delay (OUTPUT_BATCH_US)
+SYNC_WINDOW_S = 0.5         # One offset estimate (least delayed sample) per window
+SYNC_HISTORY_S = 60.0       # Windows the offset/drift line is fitted over
+RESTART_JUMP_S = 1.0        # Device clock going back this far means the Pico restarted
+CLIENT_QUEUE_CHUNKS = 500   # Sends (ticks) a subscriber may lag before it is dropped
+STATUS_S = 10.0
+PROTOCOL_VERSION = 1
+
+# One record per sample of the merged stream. t is the aligned PC time,
+# device the index of the port on the aggregator's command line.
+AGG_DTYPE = np.dtype([
+    ('t', '<f8'),           # Aligned time, time.time() seconds
+    ('time_us', '<i8'),     # Device clock, as sent
+    ('device', 'u1'),
+    ('sensor', 'u1'),       # 0 = M1 on that device
+    ('seq', '<u2'),
+    ('raw_z', '<i2'),
+    ('range', 'u1'),
+    ('z_mT', '<f4'),
+    ('force_n', '<f4'),     # NaN, apply the calibration model to z_mT
+])
+
+
+class ClockSync:
+    """
+    Device clock -> PC clock for one Pico:
+
+        t_pc = t_dev + offset + drift * (t_dev - t_ref)
+
+    fitted through the lower envelope of (t_host - t_dev), see the module
+    docstring. Times are in seconds.
+    """
+
+    def __init__(self, window_s=SYNC_WINDOW_S, history_s=SYNC_HISTORY_S):
+        self.window_s = window_s
+        self.history_s = history_s
+        self.reset()
+
+    def reset(self):
+        self.points = collections.deque()   # (t_dev, least delay) of finished windows
+        self.window = None
+        self.window_t = 0.0
+        self.window_delay = np.inf
+        self.last_t = None
+        self.offset = None
+        self.drift = 0.0
+        self.t_ref = 0.0
+        self.residual = 0.0                 # Std of the envelope about the fit, s
+        self.restarts = 0
+
+    def update(self, t_dev, t_host):
+        """Take in a batch of samples (device and PC receive times, in order)."""
+        if len(t_dev) == 0:
+            return
+        if self.last_t is not None and t_dev[0] < self.last_t - RESTART_JUMP_S:
+            restarts = self.restarts + 1
+            self.reset()
+            self.restarts = restarts
+        self.last_t = t_dev[-1]
+
+        delay = t_host - t_dev
+        windows = np.floor(t_dev / self.window_s).astype(np.int64)
+        for w in np.unique(windows):
+            i = np.argmin(np.where(windows == w, delay, np.inf))
+            if w != self.window:
+                self._close_window()
+                self.window = w
+                self.window_t, self.window_delay = t_dev[i], delay[i]
+            elif delay[i] < self.window_delay:
+                self.window_t, self.window_delay = t_dev[i], delay[i]
+
+    def _close_window(self):
+        if self.window is None:
+            return
+        self.points.append((self.window_t, self.window_delay))
+        while self.points[-1][0] - self.points[0][0] > self.history_s:
+            self.points.popleft()
+
+        t = np.array([p[0] for p in self.points])
+        d = np.array([p[1] for p in self.points])
+        self.t_ref = t[-1]
+        if len(t) >= 3:
+            self.drift, self.offset = np.polyfit(t - self.t_ref, d, 1)
+        else:
+            self.drift, self.offset = 0.0, d.min()
+        residual = d - (self.offset + self.drift * (t - self.t_ref))
+        self.offset += residual.min()
+        self.residual = float(residual.std())
+
+    def to_pc(self, t_dev):
+        """Aligned PC time of device times (array)."""
+        if self.offset is None:
+            # First window: best offset so far, no drift yet
+            return t_dev + self.window_delay
+        return t_dev + self.offset + self.drift * (t_dev - self.t_ref)
+
+
+class Device:
+    """One Pico: its stream, read cursor and clock model."""
+
+    def __init__(self, index, port, baud=BAUD_RATE):
+        self.index = index
+        self.port = port
+        self.stream = PicoStream(port, baud, keyword=Z_AXIS_KEYWORD)
+        self.sync = ClockSync()
+        self.cursor = 0
+        self.samples = 0
+        self.lost = 0
+
+    def start(self, setup=''):
+        self.stream.start()
+        for command in filter(None, (c.strip() for c in setup.split(';'))):
+            print(f"  {self.port}: {command} -> {self.stream.send_command(command)}")
+        reply = self.stream.set_output_format('binary')
+        print(f"✓ {self.port}: device {self.index} ({reply})")
+        self.cursor = self.stream.cursor()   # Nothing from before the switch to binary
+
+    def poll(self):
+        """New samples as AGG_DTYPE records with aligned times."""
+        samples, self.cursor, lost = self.stream.read_since(self.cursor)
+        self.lost += lost
+        # History dumps and trigger windows repeat old samples, keep the live stream
+        samples = samples[samples['type'] == FRAME_TYPE_SAMPLE]
+        t_dev = samples['time_us'] / 1e6
+        self.sync.update(t_dev, samples['t_host'])
+
+        records = np.zeros(len(samples), dtype=AGG_DTYPE)
+        if len(samples):
+            records['t'] = self.sync.to_pc(t_dev)
+            for name in ('time_us', 'sensor', 'seq', 'raw_z', 'range', 'z_mT', 'force_n'):
+                records[name] = samples[name]
+            records['device'] = self.index
+        self.samples += len(records)
+        return records
+
+    def close(self):
+        self.stream.close()
+
+
+class Publisher:
+    """Local TCP server fanning the merged stream out to subscribers."""
+
+    def __init__(self, header, host=AGG_HOST, port=AGG_PORT):
+        self.header = (json.dumps(header) + '\n').encode('utf-8')
+        self.clients = []
+        self._lock = threading.Lock()
+        self.server = socket.create_server((host, port))
+        self._running = True
+        self._thread = threading.Thread(target=self._accept, name='agg-accept', daemon=True)
+        self._thread.start()
+
+    def _accept(self):
+        while self._running:
+            try:
+                conn, addr = self.server.accept()
+            except OSError:
+                break
+            client = {'conn': conn, 'addr': addr, 'queue': queue.Queue(CLIENT_QUEUE_CHUNKS)}
+            client['queue'].put(self.header)
+            with self._lock:
+                self.clients.append(client)
+            threading.Thread(target=self._send, args=(client,), name='agg-send', daemon=True).start()
+            print(f"+ subscriber {addr[0]}:{addr[1]}")
+
+    def _send(self, client):
+        conn = client['conn']
+        try:
+            while True:
+                data = client['queue'].get()
+                if data is None:
+                    break
+                conn.sendall(data)
+        except OSError:
+            pass
+        finally:
+            self._drop(client, "disconnected")
+
+    def _drop(self, client, reason):
+        with self._lock:
+            if client not in self.clients:
+                return
+            self.clients.remove(client)
+        try:
+            client['conn'].shutdown(socket.SHUT_RDWR)   # Also wakes a blocked sendall()
+        except OSError:
+            pass
+        client['conn'].close()
+        try:
+            client['queue'].put_nowait(None)  # Ends the sender if it is waiting for data
+        except queue.Full:
+            pass                              # It is mid-send, the closed socket ends it
+        print(f"- subscriber {client['addr'][0]}:{client['addr'][1]} {reason}")
+
+    def publish(self, records):
+        if len(records) == 0:
+            return
+        data = records.tobytes()
+        with self._lock:
+            clients = list(self.clients)
+        for client in clients:
+            try:
+                client['queue'].put_nowait(data)
+            except queue.Full:
+                self._drop(client, "fell behind, dropped")
+
+    @property
+    def count(self):
+        with self._lock:
+            return len(self.clients)
+
+    def close(self):
+        self._running = False
+        self.server.close()
+        with self._lock:
+            clients = list(self.clients)
+        for client in clients:
+            self._drop(client, "closed")
+
+
+class Merger:
+    """Time-orders the records of all devices, MERGE_DELAY_S behind real time."""
+
+    def __init__(self, delay_s=MERGE_DELAY_S):
+        self.delay_s = delay_s
+        self.pending = np.zeros(0, dtype=AGG_DTYPE)
+        self.last_t = -np.inf     # Newest time sent
+        self.late = 0
+
+    def add(self, records):
+        if len(records):
+            self.pending = np.concatenate((self.pending, records))
+
+    def take(self, now):
+        """Records due at now, in time order."""
+        due = self.pending['t'] <= now - self.delay_s
+        out = self.pending[due]
+        self.pending = self.pending[~due]
+        if len(out) == 0:
+            return out
+        out = out[np.argsort(out['t'], kind='stable')]
+        self.late += int(np.count_nonzero(out['t'] < self.last_t))
+        self.last_t = max(self.last_t, float(out['t'][-1]))
+        return out
+
+
+class AggregatorClient:
+    """
+    Subscriber side of the merged stream.
+
+    Args:
+        host, port: Where aggregator.py listens
+        timeout: Seconds read() waits for data, None to block
+
+    Attributes after connect: devices (list of {'device', 'port'}), dtype
+    """
+
+    def __init__(self, host=AGG_HOST, port=AGG_PORT, timeout=1.0):
+        self.sock = socket.create_connection((host, port))
+        self.sock.settimeout(timeout)
+        self._rx = b''
+        while b'\n' not in self._rx:
+            chunk = self.sock.recv(1 << 16)
+            if not chunk:
+                raise ConnectionError("aggregator closed the connection")
+            self._rx += chunk
+        line, self._rx = self._rx.split(b'\n', 1)
+        header = json.loads(line)
+        if header.get('version') != PROTOCOL_VERSION:
+            raise ValueError(f"unsupported aggregator protocol {header.get('version')}")
+        self.devices = header['devices']
+        self.dtype = np.dtype([tuple(field) for field in header['dtype']])
+
+    def read(self):
+        """
+        Records received so far (empty on timeout).
+
+        Raises: ConnectionError once the aggregator has gone
+        """
+        try:
+            chunk = self.sock.recv(1 << 20)
+            if not chunk:
+                raise ConnectionError("aggregator closed the connection")
+            self._rx += chunk
+        except socket.timeout:
+            pass
+        n = len(self._rx) // self.dtype.itemsize
+        records = np.frombuffer(self._rx[:n * self.dtype.itemsize], dtype=self.dtype).copy()
+        self._rx = self._rx[n * self.dtype.itemsize:]
+        return records
+
+    def __iter__(self):
+        try:
+            while True:
+                yield self.read()
+        except ConnectionError:
+            return
+
+    def close(self):
+        self.sock.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+
+def start_devices(devices, setup):
+    """
+    Open all ports in parallel, each waits out the Pico's settle time.
+
+    Returns: list of (port, SerialException) for the ports that failed
+    """
+    errors = []
+
+    def start(dev):
+        try:
+            dev.start(setup)
+        except serial.SerialException as e:
+            errors.append((dev.port, e))
+
+    threads = [threading.Thread(target=start, args=(dev,)) for dev in devices]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    return errors
+
+
+def print_status(devices, merger, publisher, elapsed_s):
+    for dev in devices:
+        sync = dev.sync
+        offset = f"{sync.offset * 1e3:+.1f} ms" if sync.offset is not None else "-"
+        print(f"  {dev.port}: {dev.samples / elapsed_s:.0f} samples/s, offset {offset}, "
+              f"drift {sync.drift * 1e6:+.1f} ppm, envelope {sync.residual * 1e6:.0f} us, "
+              f"lost {dev.lost}, restarts {sync.restarts}")
+    print(f"  merged: {merger.late} late, {publisher.count} subscribers")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Merge several Picos into one time-aligned stream")
+    parser.add_argument('ports', nargs='*', default=SERIAL_PORTS, help="Serial ports, device 0 first")
+    parser.add_argument('--listen', type=int, default=AGG_PORT, help="TCP port for subscribers (localhost)")
+    parser.add_argument('--setup', default='', help='Commands for every Pico first, e.g. "rate 500;batch 16"')
+    parser.add_argument('--record', help="Also log the merged stream to this .npy (see recorder.py)")
+    args = parser.parse_args()
+
+    print("=" * 70)
+    print("RASPBERRY PI PICO - MULTI-DEVICE AGGREGATOR")
+    print("=" * 70)
+
+    devices = [Device(i, port) for i, port in enumerate(args.ports)]
+    print(f"\nConnecting to {len(devices)} Pico(s)...")
+    try:
+        errors = start_devices(devices, args.setup)
+        for port, e in errors:
+            print(f"✗ Error: Could not open serial port {port}")
+            print(f"  {e}")
+        if errors:
+            return
+
+        header = {
+            'version': PROTOCOL_VERSION,
+            'dtype': [list(field) for field in AGG_DTYPE.descr],
+            'devices': [{'device': dev.index, 'port': dev.port} for dev in devices],
+        }
+        try:
+            publisher = Publisher(header, port=args.listen)
+        except OSError as e:
+            print(f"✗ Error: Could not listen on {AGG_HOST}:{args.listen}")
+            print(f"  {e}")
+            return
+        merger = Merger()
+        recorder = Recorder(args.record, dtype=AGG_DTYPE) if args.record else None
+
+        print(f"\nServing the merged stream on {AGG_HOST}:{args.listen}")
+        print("Press Ctrl+C to stop.\n")
+        start_s = time.time()
+        next_status = start_s + STATUS_S
+        try:
+            while True:
+                time.sleep(POLL_S)
+                for dev in devices:
+                    merger.add(dev.poll())
+                now = time.time()
+                records = merger.take(now)
+                publisher.publish(records)
+                if recorder:
+                    recorder.append(records)
+                if now >= next_status:
+                    next_status += STATUS_S
+                    print_status(devices, merger, publisher, now - start_s)
+        except KeyboardInterrupt:
+            pass
+        finally:
+            publisher.close()
+            if recorder:
+                recorder.close()
+                print(f"✓ {recorder.count} merged samples saved to '{args.record}'")
+    finally:
+        for dev in devices:
+            dev.close()
+    print("\n✓ Serial connections closed.")
+
+
+if __name__ == "__main__":
+    main()
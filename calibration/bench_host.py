@@ -0,0 +1,322 @@
+"""
+Host-in-the-loop benchmark for the Pico force sensor firmware.
+
+Talks to a connected Pico and measures, for each output format:
+
+    rate        achieved samples/s per sensor (device clock for binary frames)
+    jitter      sample interval statistics (device timestamps for binary,
+                PC arrival times for text, which include USB batching)
+    latency     sample measured -> decoded on the PC, using a clock offset
+                from "ping" round trips before and after the run (binary)
+    throughput  USB bytes/s and samples/s received
+    drops       sequence gaps in the binary frames, plus the firmware's own
+                "stats" counters (ring_drop, usb_drop, overruns, errors)
+
+and the command round trip ("ping"). Each run writes a JSON report so
+firmware builds can be compared:
+
+    python bench_host.py --label before
+    python bench_host.py --label after
+    python bench_host.py --compare reports/bench_before_*.json reports/bench_after_*.json
+
+The Pico keeps its current mode, rate and batching; set those first (or
+pass --setup "rate 500;batch 16") so both runs measure the same thing.
+"""
+
+import argparse
+import glob
+import json
+import os
+import platform
+import queue
+import re
+import time
+
+import numpy as np
+import serial
+from pico_stream import PicoStream, FRAME_TYPE_SAMPLE
+
+# ========================================
+# BENCHMARK CONFIGURATION
+# ========================================
+SERIAL_PORT = 'COM4'  # Change to your Pico's COM port
+BAUD_RATE = 115200
+Z_AXIS_KEYWORD = "Z-axis"
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+REPORT_DIR = os.path.join(SCRIPT_DIR, 'reports')
+
+DURATION_S = 10.0       # Measurement time per output format
+SETTLE_S = 1.0          # Discarded after each format switch
+PINGS = 50              # Round trips per clock offset estimate
+FORMATS = ('text', 'binary')
+REPORT_VERSION = 1
+
+
+def percentiles(values, scale=1.0):
+    """min/mean/p50/p99/max (and std) of values, or None if there are none."""
+    values = np.asarray(values, dtype=float) * scale
+    if len(values) == 0:
+        return None
+    return {
+        'n': int(len(values)),
+        'min': float(values.min()),
+        'mean': float(values.mean()),
+        'std': float(values.std()),
+        'p50': float(np.percentile(values, 50)),
+        'p99': float(np.percentile(values, 99)),
+        'max': float(values.max()),
+    }
+
+
+def command_lines(stream, command, timeout=1.0):
+    """Send a command and collect every reply line until the Pico goes quiet."""
+    first = stream.send_command(command, timeout=timeout)
+    lines = [first]
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            line = stream.lines.get(timeout=0.1)
+        except queue.Empty:
+            break
+        if line.startswith("OK") or line.startswith("ERR"):
+            lines.append(line)
+    return lines
+
+
+def parse_pairs(words):
+    """["ring_drop", "0", "usb_drop", "3"] -> {"ring_drop": 0, "usb_drop": 3}"""
+    pairs = {}
+    for key, value in zip(words[::2], words[1::2]):
+        try:
+            pairs[key] = float(value) if '.' in value else int(value)
+        except ValueError:
+            pairs[key] = value
+    return pairs
+
+
+def read_stats(stream):
+    """Firmware "stats" counters: {"loop": {...}, "M1": {...}, ...}"""
+    stats = {}
+    for line in command_lines(stream, "stats"):
+        words = line.split()
+        if len(words) < 3 or words[:2] != ["OK", "stats"]:
+            continue
+        if re.fullmatch(r'M\d+', words[2]):
+            stats[words[2]] = parse_pairs(words[3:])
+        else:
+            stats['loop'] = parse_pairs(words[2:])
+    return stats
+
+
+def ping(stream, count=PINGS):
+    """
+    Round trips of "ping". The offset maps device time to PC time:
+    device_us + offset_us = PC time in us, taken from the fastest round trip.
+
+    Returns: (round trip stats in ms, offset_us, PC time of that ping)
+    """
+    rtts, offsets, stamps = [], [], []
+    for i in range(count):
+        t_send = time.time()
+        reply = stream.send_command(f"ping {i}", timeout=1.0)
+        t_recv = time.time()
+        match = re.match(rf'OK pong {i} (\d+)', reply)
+        if not match:
+            continue
+        rtts.append(t_recv - t_send)
+        mid = (t_send + t_recv) / 2
+        offsets.append(mid * 1e6 - int(match.group(1)))
+        stamps.append(mid)
+    if not rtts:
+        return None, None, None
+    best = int(np.argmin(rtts))
+    return percentiles(rtts, 1e3), offsets[best], stamps[best]
+
+
+def unwrap_diff_u32(a, b):
+    """(a - b) of 32-bit device times, as signed microseconds."""
+    d = np.mod(np.asarray(a, dtype=np.int64) - np.asarray(b, dtype=np.int64), 1 << 32)
+    return np.where(d >= 1 << 31, d - (1 << 32), d)
+
+
+def run_format(stream, output_format, duration_s):
+    """Stream in one format for duration_s and measure it."""
+    reply = stream.set_output_format(output_format)
+    if not reply.startswith("OK"):
+        raise RuntimeError(f"format {output_format}: {reply}")
+    time.sleep(SETTLE_S)
+    stream.send_command("stats reset")
+
+    rtt_before, offset_before, t_before = ping(stream)
+    cursor = stream.cursor()
+    bytes_start = stream.bytes_read
+    t_start = time.time()
+    time.sleep(duration_s)
+    samples, cursor, lost = stream.read_since(cursor)
+    elapsed = time.time() - t_start
+    rx_bytes = stream.bytes_read - bytes_start
+    rtt_after, offset_after, t_after = ping(stream)
+    stats = read_stats(stream)
+
+    samples = samples[samples['type'] == FRAME_TYPE_SAMPLE]
+    result = {
+        'duration_s': elapsed,
+        'rx_bytes_per_s': rx_bytes / elapsed,
+        'rx_samples_per_s': len(samples) / elapsed,
+        'host_ring_lost': int(lost),
+        'ping_ms': rtt_before,
+        'firmware_stats': stats,
+        'sensors': {},
+    }
+
+    # Clock offset at any PC time, linear between the two ping bursts (drift)
+    def offset_at(t):
+        if offset_before is None or offset_after is None or t_after == t_before:
+            return offset_before if offset_before is not None else offset_after
+        return offset_before + (offset_after - offset_before) * (t - t_before) / (t_after - t_before)
+
+    if offset_before is not None and offset_after is not None and t_after > t_before:
+        result['clock_drift_ppm'] = (offset_after - offset_before) / ((t_after - t_before) * 1e6) * 1e6
+
+    for sensor in np.unique(samples['sensor']):
+        s = samples[samples['sensor'] == sensor]
+        entry = {'samples': int(len(s))}
+        if output_format == 'binary' and len(s) > 1:
+            dt_us = unwrap_diff_u32(s['time_us'][1:], s['time_us'][:-1])
+            span_s = dt_us.sum() / 1e6
+            entry['rate_hz'] = (len(s) - 1) / span_s if span_s > 0 else 0.0
+            entry['interval_us'] = percentiles(dt_us)
+            gaps = np.mod(np.diff(s['seq'].astype(np.int64)), 1 << 16) - 1
+            entry['dropped_frames'] = int(gaps[gaps > 0].sum())
+            if offset_before is not None:
+                device_now_us = s['t_host'] * 1e6 - offset_at(s['t_host'])
+                entry['latency_ms'] = percentiles(unwrap_diff_u32(device_now_us.astype(np.int64), s['time_us']), 1e-3)
+        elif len(s) > 1:
+            # Text lines carry no device time: PC arrival times, batched by USB
+            dt_s = np.diff(s['t_host'])
+            entry['rate_hz'] = (len(s) - 1) / (s['t_host'][-1] - s['t_host'][0]) if s['t_host'][-1] > s['t_host'][0] else 0.0
+            entry['arrival_interval_us'] = percentiles(dt_s, 1e6)
+        result['sensors'][f"M{int(sensor) + 1}"] = entry
+    return result
+
+
+def benchmark(port, label, duration_s, setup):
+    stream = PicoStream(port, BAUD_RATE, keyword=Z_AXIS_KEYWORD).start()
+    try:
+        for command in filter(None, (c.strip() for c in setup.split(';'))):
+            print(f"  {command}: {stream.send_command(command)}")
+        original_format = stream.send_command("format")
+        original_format = 'binary' if 'binary' in original_format else 'text'
+        stream.output_format = original_format
+
+        report = {
+            'version': REPORT_VERSION,
+            'label': label,
+            'time': time.strftime('%Y-%m-%dT%H:%M:%S'),
+            'host': platform.node(),
+            'port': port,
+            'firmware': {
+                'rate': stream.send_command("rate"),
+                'batch': stream.send_command("batch"),
+                'power': stream.send_command("power"),
+                'sensors': [line for line in command_lines(stream, "sensor") if line.startswith("OK")],
+            },
+            'formats': {},
+        }
+        rtt, _, _ = ping(stream)
+        report['ping_ms'] = rtt
+        for output_format in FORMATS:
+            print(f"  {output_format}: {duration_s:.0f} s...")
+            report['formats'][output_format] = run_format(stream, output_format, duration_s)
+        stream.set_output_format(original_format)
+    finally:
+        stream.close()
+    return report
+
+
+def print_report(report):
+    print(f"\n{report['label']}  ({report['time']}, {report['firmware']['rate']})")
+    if report.get('ping_ms'):
+        p = report['ping_ms']
+        print(f"  ping        p50 {p['p50']:.2f} ms  p99 {p['p99']:.2f} ms  max {p['max']:.2f} ms")
+    for name, fmt in report['formats'].items():
+        print(f"  [{name}] {fmt['rx_bytes_per_s'] / 1024:.1f} KiB/s, {fmt['rx_samples_per_s']:.1f} samples/s")
+        loop = fmt['firmware_stats'].get('loop', {})
+        print(f"    firmware    ring_drop {loop.get('ring_drop')}  usb_drop {loop.get('usb_drop')}  "
+              f"loop_overrun {loop.get('loop_overrun')}")
+        for sensor, s in fmt['sensors'].items():
+            line = f"    {sensor:<4} {s.get('rate_hz', 0):8.2f} Hz"
+            interval = s.get('interval_us') or s.get('arrival_interval_us')
+            if interval:
+                line += f"  interval std {interval['std']:.1f} us  max {interval['max']:.0f} us"
+            if 'dropped_frames' in s:
+                line += f"  dropped {s['dropped_frames']}"
+            if s.get('latency_ms'):
+                line += f"  latency p50 {s['latency_ms']['p50']:.2f} ms  p99 {s['latency_ms']['p99']:.2f} ms"
+            print(line)
+
+
+def flatten(report, prefix=''):
+    """Numeric leaves of a report as {"formats.binary.rx_bytes_per_s": ..., ...}"""
+    flat = {}
+    for key, value in report.items():
+        path = f"{prefix}{key}"
+        if isinstance(value, dict):
+            flat.update(flatten(value, path + '.'))
+        elif isinstance(value, (int, float)) and not isinstance(value, bool) and key != 'version':
+            flat[path] = value
+    return flat
+
+
+def compare(path_a, path_b):
+    """Print every metric of two reports side by side with the change."""
+    with open(path_a) as f:
+        a = json.load(f)
+    with open(path_b) as f:
+        b = json.load(f)
+    fa, fb = flatten(a), flatten(b)
+    print(f"{'metric':<60} {a['label']:>14} {b['label']:>14} {'change':>9}")
+    for key in sorted(set(fa) | set(fb)):
+        va, vb = fa.get(key), fb.get(key)
+        change = ''
+        if va is not None and vb is not None and va != 0:
+            change = f"{(vb - va) / abs(va) * 100:+.1f}%"
+        fmt = lambda v: '-' if v is None else f"{v:.4g}"
+        print(f"{key:<60} {fmt(va):>14} {fmt(vb):>14} {change:>9}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmark a connected Pico force sensor")
+    parser.add_argument('--port', default=SERIAL_PORT)
+    parser.add_argument('--label', default='run', help="Name of this firmware build in the report")
+    parser.add_argument('--duration', type=float, default=DURATION_S, help="Seconds per output format")
+    parser.add_argument('--setup', default='', help='Commands to send first, e.g. "rate 500;batch 16"')
+    parser.add_argument('--compare', nargs=2, metavar=('A', 'B'), help="Compare two reports instead of running")
+    args = parser.parse_args()
+
+    if args.compare:
+        a, b = (sorted(glob.glob(p))[-1] if glob.glob(p) else p for p in args.compare)
+        compare(a, b)
+        return
+
+    print("=" * 70)
+    print("RASPBERRY PI PICO - FIRMWARE BENCHMARK")
+    print("=" * 70)
+    print(f"\nConnecting to Pico on {args.port}...")
+    try:
+        report = benchmark(args.port, args.label, args.duration, args.setup)
+    except serial.SerialException as e:
+        print(f"✗ Error: Could not open serial port {args.port}")
+        print(f"  {e}")
+        return
+
+    os.makedirs(REPORT_DIR, exist_ok=True)
+    path = os.path.join(REPORT_DIR, time.strftime(f'bench_{args.label}_%Y%m%d_%H%M%S.json'))
+    with open(path, 'w') as f:
+        json.dump(report, f, indent=2)
+    print_report(report)
+    print(f"\n✓ Report saved to '{path}'")
+
+
+if __name__ == "__main__":
+    main()
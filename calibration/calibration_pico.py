@@ -3,7 +3,7 @@ import numpy as np
 import time
 import os
 import json
-import re
+from pico_stream import PicoStream, evaluate_model
 
 # ========================================
 # SENSOR MAPPING CONFIGURATION
@@ -16,110 +16,108 @@ Z_AXIS_KEYWORD = "Z-axis"        # Keyword to search for Z-axis data (e.g., "Z-a
 # ========================================
 SERIAL_PORT = 'COM4'  # Change to your Pico's COM port
 BAUD_RATE = 115200
+OUTPUT_FORMAT = 'text'  # 'text' or 'binary', must match OUTPUT_FORMAT_DEFAULT in firmware
 SAMPLES_PER_WEIGHT = 10
+SAMPLE_TIMEOUT_S = 1.0  # Longest wait per sample before giving up
 KG_TO_NEWTONS = 9.80665
+FIT_MODEL = 'linear'    # 'linear', or opt in to 'poly' or 'pwl' (piecewise-linear through the points)
+POLY_ORDER = 3          # Polynomial order for FIT_MODEL = 'poly' (the Pico takes up to 5)
+UPLOAD_TO_PICO = False  # Send the model to the Pico with "cal" commands and commit it to flash
 
 # ========================================
 # HELPER FUNCTIONS
 # ========================================
 
-def extract_sensor_value(line, keyword):
+def collect_samples(stream, description, num_samples):
     """
-    Extract sensor value from serial output.
+    Collect the next sensor readings from the stream and return the average.
     
-    Handles formats like:
-    - "Current(M1): 0.013 A"
-    - "Z-axis(M1): 12.693 mT"
-    - "Current: 0.013 A"
+    Args:
+        stream: Running PicoStream
+        description: Human-readable description
+        num_samples: Number of samples to collect
     
-    Returns: (value, sensor_label) or (None, None) if not found
+    Returns: (average_value, sensor_label) or (None, None) if not available
     """
-    if keyword not in line:
-        return None, None
+    # Skip anything measured before the weight settled
+    time.sleep(0.2)
+    cursor = stream.cursor()
     
-    try:
-        # Pattern: Keyword(optional_label): value unit
-        # Matches: "Current(M1): 0.013" or "Z-axis: 12.693"
-        pattern = rf"{keyword}\(?([^)]*)\)?:\s*([-+]?\d+\.?\d*)"
-        match = re.search(pattern, line)
-        
-        if match:
-            sensor_label = match.group(1) if match.group(1) else keyword
-            value = float(match.group(2))
-            return value, sensor_label
-        
-        return None, None
-    except (ValueError, IndexError):
+    print(f"\n  Collecting {num_samples} {description} samples...")
+    samples, _ = stream.wait_for(cursor, num_samples, timeout=SAMPLE_TIMEOUT_S * num_samples)
+    for i, value in enumerate(samples['z_mT']):
+        print(f"    Sample {i+1}: {description} = {value:.3f}")
+    
+    if len(samples) == 0:
+        print(f"  ✗ No {description} samples collected!")
         return None, None
+    if len(samples) < num_samples:
+        print(f"    ({num_samples - len(samples)} samples missing - timed out)")
+    
+    sensor_label = f"M{samples['sensor'][-1] + 1}"
+    avg = np.mean(samples['z_mT'])
+    std = np.std(samples['z_mT'])
+    print(f"\n  Average {description}: {avg:.3f} ± {std:.3f}")
+    return avg, sensor_label
 
 
-def read_sensor_value(ser, keyword, description):
+def fit_model(z_values, forces):
     """
-    Read a single sensor value from serial.
+    Fit FIT_MODEL to the calibration points.
     
-    Args:
-        ser: Serial connection
-        keyword: Keyword to search for (e.g., "Current", "Z-axis")
-        description: Human-readable description (e.g., "Current", "Z-axis")
-    
-    Returns: (value, sensor_label) or (None, None)
+    Returns: model dict (type, coefficients or knots, z_min, z_max, r_squared)
+             as stored in calibration_data.json, or None if the points can't be fitted
     """
-    if keyword is None:
-        return None, None
+    z_values = np.asarray(z_values, dtype=float)
+    forces = np.asarray(forces, dtype=float)
+    unique_z = np.unique(z_values)
+    if len(unique_z) < 2:
+        return None
     
-    while True:
-        try:
-            line = ser.readline().decode('utf-8').strip()
-            if not line:
-                continue
-            
-            value, label = extract_sensor_value(line, keyword)
-            if value is not None:
-                return value, label
-        except (ValueError, UnicodeDecodeError, AttributeError):
-            continue
+    model = {"z_min": float(unique_z[0]), "z_max": float(unique_z[-1])}
+    if FIT_MODEL == 'pwl':
+        # Points at the same reading become one knot
+        model["type"] = "pwl"
+        model["knots"] = [[float(z), float(np.mean(forces[z_values == z]))] for z in unique_z]
+    else:
+        # Below points - 1, so a polynomial never just interpolates the points
+        order = 1 if FIT_MODEL == 'linear' else max(1, min(POLY_ORDER, 5, len(unique_z) - 2))
+        if FIT_MODEL == 'poly' and order < POLY_ORDER:
+            print(f"  Polynomial order capped at {order} for {len(unique_z)} distinct readings")
+        model["type"] = "poly"
+        model["coefficients"] = [float(c) for c in np.polyfit(z_values, forces, order)[::-1]]
+    
+    residuals = forces - evaluate_model(model, z_values)
+    ss_res = np.sum(residuals**2)
+    ss_tot = np.sum((forces - np.mean(forces))**2)
+    model["r_squared"] = float(1 - ss_res / ss_tot) if ss_tot > 0 else 0.0
+    return model
 
 
-def collect_samples(ser, keyword, description, num_samples):
+def upload_model(stream, sensor_label, model, z_values, forces):
     """
-    Collect multiple sensor readings and return the average.
-    
-    Args:
-        ser: Serial connection
-        keyword: Sensor keyword to track
-        description: Human-readable description
-        num_samples: Number of samples to collect
+    Send the calibration points and model to the Pico and commit them to flash.
+    The points go first so the Pico reports R^2 against the same data.
     
-    Returns: (average_value, sensor_label) or (None, None) if not available
+    Returns: True if the Pico accepted and stored the model
     """
-    if keyword is None:
-        return None, None
-    
-    ser.reset_input_buffer()
-    time.sleep(0.2)
-    
-    print(f"\n  Collecting {num_samples} {description} samples...")
-    samples = []
-    sensor_label = None
+    n = int(sensor_label[1:]) if sensor_label and sensor_label[1:].isdigit() else 1
+    commands = [f"cal {n} clear"]
+    commands += [f"cal {n} point {z:.6g} {f:.6g}" for z, f in zip(z_values, forces)]
+    if model["type"] == "pwl":
+        commands.append(f"cal {n} fit pwl")
+    else:
+        coeffs = " ".join(f"{c:.9g}" for c in model["coefficients"])
+        commands.append(f"cal {n} poly {model['z_min']:.6g} {model['z_max']:.6g} {coeffs}")
+    commands.append(f"cal {n} commit")
     
-    for i in range(num_samples):
-        value, label = read_sensor_value(ser, keyword, description)
-        if value is not None:
-            samples.append(value)
-            sensor_label = label
-            print(f"    Sample {i+1}: {description} = {value:.3f}")
-            time.sleep(0.1)
-        else:
-            print(f"    Sample {i+1}: {description} = (skipped - no data)")
-    
-    if not samples:
-        print(f"  ✗ No {description} samples collected!")
-        return None, None
-    
-    avg = np.mean(samples)
-    std = np.std(samples)
-    print(f"\n  Average {description}: {avg:.3f} ± {std:.3f}")
-    return avg, sensor_label
+    for command in commands:
+        reply = stream.send_command(command)
+        if reply.startswith("ERR"):
+            print(f"✗ Pico rejected '{command}': {reply}")
+            return False
+    print(f"✓ Model committed to the Pico ({reply})")
+    return True
 
 
 # ========================================
@@ -139,9 +137,7 @@ def main():
     print(f"\nConnecting to Pico on {SERIAL_PORT}...")
     
     try:
-        ser = serial.Serial(SERIAL_PORT, BAUD_RATE, timeout=1)
-        time.sleep(2)
-        ser.reset_input_buffer()
+        stream = PicoStream(SERIAL_PORT, BAUD_RATE, output_format=OUTPUT_FORMAT, keyword=Z_AXIS_KEYWORD).start()
         print("✓ Connected!\n")
     except serial.SerialException as e:
         print(f"✗ Error: Could not open serial port {SERIAL_PORT}")
@@ -176,7 +172,7 @@ def main():
             
             # Collect Z-axis data
             z_axis_avg, z_axis_label = collect_samples(
-                ser, Z_AXIS_KEYWORD, "Z-axis", SAMPLES_PER_WEIGHT
+                stream, "Z-axis", SAMPLES_PER_WEIGHT
             )
             
             # Store calibration point
@@ -189,10 +185,9 @@ def main():
         except ValueError:
             print("✗ Invalid input. Please enter a number or 'done'.")
     
-    ser.close()
-    
     if len(weights_kg) < 2:
         print("\n✗ Error: Need at least 2 calibration points.")
+        stream.close()
         return
     
     # Convert to numpy arrays
@@ -226,6 +221,11 @@ def main():
                 "sensor_label": z_axis_labels[0] if z_axis_labels[0] else Z_AXIS_KEYWORD
             }
             
+            # Higher order / piecewise model, used instead of slope/intercept when present
+            model = fit_model(z_axis_readings_clean, forces_newtons[:len(z_axis_readings_clean)])
+            if model is not None:
+                z_axis_calib["model"] = model
+            
             print("\n" + "=" * 70)
             print("Z-AXIS SENSOR CALIBRATION RESULTS")
             print("=" * 70)
@@ -233,6 +233,16 @@ def main():
             print(f"Slope:     {slope_z:.6f}")
             print(f"Intercept: {intercept_z:.6f}")
             print(f"R² value:  {r_squared_z:.6f}")
+            if model is not None:
+                desc = f"{len(model['knots'])}-knot piecewise-linear" if model["type"] == "pwl" \
+                    else f"order {len(model['coefficients']) - 1} polynomial"
+                print(f"Model:     {desc}, R² = {model['r_squared']:.6f}")
+            
+            if UPLOAD_TO_PICO and model is not None:
+                upload_model(stream, z_axis_calib["sensor_label"], model,
+                             z_axis_readings_clean, forces_newtons[:len(z_axis_readings_clean)])
+    
+    stream.close()
     
     # ========================================
     # SAVE CALIBRATION DATA TO JSON
@@ -0,0 +1,422 @@
+"""
+Shared acquisition for the Pico force sensor scripts.
+
+A background thread does bulk serial reads and decodes them into a
+preallocated numpy ring buffer of timestamped samples. Both the text
+("Z-axis(M1): 12.693 mT Force(M1): 1.234 N") and the binary frame format
+are decoded a whole read at a time, with no per-line Python loop. Any other
+text lines (command replies, "OK event ..." headers) are kept in a queue
+for send_command() and the like.
+
+    stream = PicoStream('COM4', output_format='text')
+    stream.start()
+    cursor = stream.cursor()
+    ...
+    samples, cursor, lost = stream.read_since(cursor)
+    print(samples['z_mT'], samples['t_host'])
+    stream.close()
+"""
+
+import queue
+import re
+import threading
+import time
+
+import numpy as np
+import serial
+
+# ========================================
+# BINARY FRAME FORMAT
+# ========================================
+# Must match sample_frame_t in force_sensor.c
+FRAME_SYNC = b'\xa5\x5a'
+FRAME_DTYPE = np.dtype([
+    ('sync0', 'u1'), ('sync1', 'u1'), ('type', 'u1'), ('sensor', 'u1'),
+    ('seq', '<u2'), ('time_us', '<u4'), ('x', '<i2'), ('y', '<i2'), ('z', '<i2'),
+    ('status', 'u1'), ('range', 'u1'), ('crc', '<u2'),
+])
+FRAME_SIZE = FRAME_DTYPE.itemsize   # 20 bytes
+FRAME_TYPE_SAMPLE = 0x01
+FRAME_TYPE_HISTORY = 0x02           # "dump" replay
+FRAME_TYPE_EVENT = 0x03             # "trigger" capture window
+Z_OFFSET_MT = 20.0                  # Firmware default before a tare, see PicoStream.sync_z_offsets()
+MAX_SENSORS = 8                     # CAL_STORE_MAX_SENSORS in firmware
+CAL_LUT_SIZE = 65                   # Force LUT entries over the calibrated span, as in firmware
+
+# MLX90393 Z-axis LSB in uT, [GAIN_SEL][RES] (HALLCONF=0xC)
+Z_LSB_UT = np.array([
+    [1.210, 2.420, 4.840, 9.680],
+    [0.968, 1.936, 3.872, 7.744],
+    [0.726, 1.452, 2.904, 5.808],
+    [0.605, 1.210, 2.420, 4.840],
+    [0.484, 0.968, 1.936, 3.872],
+    [0.403, 0.807, 1.613, 3.227],
+    [0.323, 0.645, 1.291, 2.581],
+    [0.242, 0.484, 0.968, 1.936],
+])
+
+
+def _crc16_table():
+    table = np.zeros(256, dtype=np.uint16)
+    for i in range(256):
+        crc = i << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+        table[i] = crc & 0xFFFF
+    return table
+
+
+CRC16_TABLE = _crc16_table()   # CRC-16/CCITT-FALSE, as crc16_ccitt() in the firmware
+
+# ========================================
+# RING BUFFER RECORDS
+# ========================================
+# One record per sample. Text lines carry no device timestamp, so time_us
+# is the host receive time there; binary frames carry the device clock,
+# unwrapped to 64 bits. force_n is what the Pico printed (text), or
+# force_fn(z_mT) if one is given, otherwise NaN.
+SAMPLE_DTYPE = np.dtype([
+    ('t_host', 'f8'),       # time.time() when the read completed
+    ('time_us', 'i8'),      # Device time (binary) or host time (text), us
+    ('type', 'u1'),         # FRAME_TYPE_*, text samples are FRAME_TYPE_SAMPLE
+    ('sensor', 'u1'),       # 0 = M1
+    ('seq', 'u2'),          # Binary only
+    ('raw_z', 'i2'),        # Binary only
+    ('range', 'u1'),        # Binary only
+    ('z_mT', 'f4'),
+    ('force_n', 'f4'),
+])
+
+RING_SIZE = 1 << 20         # Samples kept (about 30 MB), oldest overwritten
+READ_SIZE = 1 << 16         # Largest single serial read
+READ_TIMEOUT = 0.02         # Serial read timeout, bounds the batching delay
+
+
+def raw_z_to_mT(raw_z, range_byte, z_offset=Z_OFFSET_MT):
+    """Convert raw Z counts to mT the same way the firmware does (arrays or scalars)."""
+    range_byte = np.asarray(range_byte)
+    lsb = Z_LSB_UT[(range_byte >> 2) & 0x07, range_byte & 0x03]
+    return np.asarray(raw_z) * lsb / 1000.0 + z_offset
+
+
+def evaluate_model(model, z):
+    """
+    Force for Z the way the firmware computes it (arrays or scalars), before
+    its clamp to >= 0. The model (calibration_data.json form: polynomial
+    coefficients ascending, or pwl knots) is sampled into CAL_LUT_SIZE
+    points over [z_min, z_max] and interpolated linearly. Outside the span
+    the first/last LUT segment is extended, so a polynomial is not evaluated
+    there. Linear models come out exact everywhere.
+    """
+    z_lut = np.linspace(model["z_min"], model["z_max"], CAL_LUT_SIZE)
+    if model["type"] == "pwl":
+        kz = np.array([k[0] for k in model["knots"]])
+        kf = np.array([k[1] for k in model["knots"]])
+        seg = np.clip(np.searchsorted(kz, z_lut) - 1, 0, len(kz) - 2)
+        f_lut = kf[seg] + (kf[seg + 1] - kf[seg]) * (z_lut - kz[seg]) / (kz[seg + 1] - kz[seg])
+    else:
+        f_lut = np.polyval(model["coefficients"][::-1], z_lut)
+
+    pos = (np.asarray(z, dtype=float) - z_lut[0]) * ((CAL_LUT_SIZE - 1) / (z_lut[-1] - z_lut[0]))
+    i = np.clip(np.floor(pos).astype(np.int64), 0, CAL_LUT_SIZE - 2)
+    return f_lut[i] + (f_lut[i + 1] - f_lut[i]) * (pos - i)
+
+
+def decode_frames(buf):
+    """
+    Find every CRC-valid binary frame in buf (bytes).
+
+    Returns: (frames as a FRAME_DTYPE array, start offsets, end of the
+              decoded part; bytes from there on may start a frame)
+    """
+    data = np.frombuffer(buf, dtype=np.uint8)
+    n = len(data)
+    if n == 0:
+        return np.zeros(0, FRAME_DTYPE), np.zeros(0, np.int64), 0
+    starts = np.flatnonzero((data[:-1] == 0xA5) & (data[1:] == 0x5A))
+    complete = starts[starts + FRAME_SIZE <= n]
+
+    rows = data[complete[:, None] + np.arange(FRAME_SIZE)]
+    crc = np.full(len(rows), 0xFFFF, dtype=np.uint16)
+    for col in range(2, FRAME_SIZE - 2):
+        crc = ((crc << 8) & 0xFFFF) ^ CRC16_TABLE[((crc >> 8) ^ rows[:, col]) & 0xFF]
+    valid = crc == (rows[:, -2].astype(np.uint16) | (rows[:, -1].astype(np.uint16) << 8))
+    offsets = complete[valid]
+    rows = rows[valid]
+
+    # A sync pattern inside a frame can pass the CRC by chance; keep the first
+    if len(offsets) > 1 and np.any(np.diff(offsets) < FRAME_SIZE):
+        keep = np.ones(len(offsets), dtype=bool)
+        end = -1
+        for i, off in enumerate(offsets):
+            keep[i] = off >= end
+            if keep[i]:
+                end = off + FRAME_SIZE
+        offsets = offsets[keep]
+        rows = rows[keep]
+
+    # Keep an incomplete frame (or a lone first sync byte) for the next read
+    end = offsets[-1] + FRAME_SIZE if len(offsets) else 0
+    pending = starts[(starts + FRAME_SIZE > n) & (starts >= end)]
+    if len(pending):
+        tail = pending[0]
+    elif data[-1] == 0xA5:
+        tail = n - 1
+    else:
+        tail = n
+    frames = np.ascontiguousarray(rows).view(FRAME_DTYPE).reshape(-1)
+    return frames, offsets, int(tail)
+
+
+class PicoStream:
+    """
+    Background reader for the Pico's sample stream.
+
+    Args:
+        port, baud: Serial port settings
+        output_format: 'text' or 'binary', the firmware's current format
+        keyword: Label of the text lines to decode ("Z-axis")
+        force_fn: Optional vectorised function z_mT -> force_n used for samples
+                  that do not carry a force (binary frames)
+        ring_size: Samples kept in memory
+    """
+
+    def __init__(self, port, baud=115200, output_format='text', keyword='Z-axis',
+                 force_fn=None, ring_size=RING_SIZE):
+        self.port = port
+        self.baud = baud
+        self.output_format = output_format
+        self.force_fn = force_fn
+        self.z_offset = np.full(MAX_SENSORS, Z_OFFSET_MT)  # Per sensor index, for binary frames
+        self.ring = np.zeros(ring_size, dtype=SAMPLE_DTYPE)
+        self.written = 0            # Samples ever appended; the ring holds the newest
+        self.lines = queue.Queue()  # Non-sample text lines, oldest first
+        self.bytes_read = 0
+        sample = (rb'%s(?:\(M(\d+)\))?:\s*([-+]?\d+\.?\d*)\s*mT(?:\s*Force(?:\(M\d+\))?:\s*([-+]?\d+\.?\d*))?'
+                  % re.escape(keyword.encode('ascii')))
+        self._sample_re = re.compile(sample)
+        self._sample_line_re = re.compile(rb'[^\n]*' + sample + rb'[^\n]*\n')
+        self._lock = threading.Lock()
+        self._new_data = threading.Condition(self._lock)
+        self._rx = b''
+        self._text_rx = b''
+        self._last_time_u32 = None
+        self._time_wraps = 0
+        self._thread = None
+        self._running = False
+        self.ser = None
+
+    # ---------------- lifecycle ----------------
+
+    def start(self, settle_s=2.0):
+        """Open the port and start the reader thread."""
+        self.ser = serial.Serial(self.port, self.baud, timeout=READ_TIMEOUT)
+        time.sleep(settle_s)
+        self.ser.reset_input_buffer()
+        self._running = True
+        self._thread = threading.Thread(target=self._run, name='pico-stream', daemon=True)
+        self._thread.start()
+        return self
+
+    def close(self):
+        self._running = False
+        if self._thread is not None:
+            self._thread.join(timeout=1.0)
+        if self.ser is not None:
+            self.ser.close()
+
+    def __enter__(self):
+        return self.start()
+
+    def __exit__(self, *exc):
+        self.close()
+
+    # ---------------- consumers ----------------
+
+    def cursor(self):
+        """Position after the newest sample, for read_since()."""
+        with self._lock:
+            return self.written
+
+    def read_since(self, cursor):
+        """
+        Samples appended after cursor.
+
+        Returns: (copy of the samples, new cursor, samples lost because the
+                  ring wrapped past cursor)
+        """
+        with self._lock:
+            return self._slice(cursor, self.written)
+
+    def wait_for(self, cursor, count, timeout=None, sample_type=FRAME_TYPE_SAMPLE):
+        """
+        Block until count samples of sample_type arrived after cursor.
+
+        Returns: (those samples, possibly fewer on timeout, new cursor)
+        """
+        deadline = None if timeout is None else time.time() + timeout
+        got = []
+        have = 0
+        while have < count:
+            with self._lock:
+                if self.written == cursor:
+                    remaining = None if deadline is None else deadline - time.time()
+                    if remaining is not None and remaining <= 0:
+                        break
+                    self._new_data.wait(remaining)
+                samples, cursor, _ = self._slice(cursor, self.written)
+            samples = samples[samples['type'] == sample_type]
+            got.append(samples)
+            have += len(samples)
+        samples = np.concatenate(got) if got else np.zeros(0, SAMPLE_DTYPE)
+        return samples[:count], cursor
+
+    def latest(self, count=1):
+        """Copy of the newest count samples (fewer if not enough yet)."""
+        with self._lock:
+            return self._slice(max(0, self.written - count), self.written)[0]
+
+    def send_command(self, command, timeout=5.0):
+        """
+        Send a firmware command and wait for its OK/ERR reply.
+
+        Returns: reply line
+        """
+        while not self.lines.empty():
+            self.lines.get_nowait()
+        self.ser.write((command + "\n").encode('ascii'))
+        deadline = time.time() + timeout
+        while True:
+            remaining = deadline - time.time()
+            if remaining <= 0:
+                return "ERR no reply"
+            try:
+                line = self.lines.get(timeout=remaining)
+            except queue.Empty:
+                return "ERR no reply"
+            if line.startswith("OK") or line.startswith("ERR"):
+                return line
+
+    def set_output_format(self, output_format):
+        """Switch the firmware and the decoder to 'text' or 'binary'."""
+        reply = self.send_command(f"format {output_format}")
+        if reply.startswith("OK"):
+            self.output_format = output_format
+            if output_format == 'binary':
+                self.sync_z_offsets()
+        return reply
+
+    def sync_z_offsets(self):
+        """
+        Read each sensor's tare from the Pico, so binary frames convert
+        to the same mT as the firmware. Call again after a "tare".
+        """
+        for index in range(MAX_SENSORS):
+            reply = self.send_command(f"tare {index + 1} show")
+            match = re.search(r'offset (-?\d+\.\d+) mT', reply)
+            if not match:
+                break
+            self.z_offset[index] = float(match.group(1))
+
+    # ---------------- reader thread ----------------
+
+    def _slice(self, start, end):
+        """Copy of samples start..end (absolute indices), call with the lock held."""
+        size = len(self.ring)
+        lost = max(0, (end - size) - start)
+        start = max(start, end - size)
+        idx = np.arange(start, end) % size
+        return self.ring[idx], end, lost
+
+    def _append(self, records):
+        if len(records) == 0:
+            return
+        size = len(self.ring)
+        if len(records) > size:
+            records = records[-size:]
+        with self._lock:
+            idx = np.arange(self.written, self.written + len(records)) % size
+            self.ring[idx] = records
+            self.written += len(records)
+            self._new_data.notify_all()
+
+    def _run(self):
+        while self._running:
+            try:
+                chunk = self.ser.read(max(1, min(self.ser.in_waiting, READ_SIZE)))
+            except serial.SerialException:
+                break
+            if not chunk:
+                continue
+            self.bytes_read += len(chunk)
+            self._append(self._decode(chunk, time.time()))
+
+    def _decode(self, chunk, t_host):
+        buf = self._rx + chunk
+        if self.output_format == 'binary':
+            frames, offsets, tail = decode_frames(buf)
+            # Whatever is not part of a frame is text (replies, event headers)
+            mask = np.ones(tail, dtype=bool)
+            if len(offsets):
+                mask[(offsets[:, None] + np.arange(FRAME_SIZE)).ravel()] = False
+            text = np.frombuffer(buf, dtype=np.uint8)[:tail][mask].tobytes()
+            self._rx = buf[tail:]
+            self._collect_lines(text)
+            return self._frame_records(frames, t_host)
+
+        # Text: decode every complete line of the read in one regex pass
+        end = buf.rfind(b'\n') + 1
+        self._rx = buf[end:]
+        text = buf[:end]
+        matches = self._sample_re.findall(text)
+        self._collect_lines(self._sample_line_re.sub(b'', text))
+        return self._text_records(matches, t_host)
+
+    def _collect_lines(self, text):
+        self._text_rx += text
+        *lines, self._text_rx = self._text_rx.split(b'\n')
+        for line in lines:
+            line = line.strip().decode('utf-8', errors='replace')
+            if line:
+                self.lines.put(line)
+
+    def _frame_records(self, frames, t_host):
+        records = np.zeros(len(frames), dtype=SAMPLE_DTYPE)
+        if len(frames) == 0:
+            return records
+        # Unwrap the 32-bit device clock (all sensors share it)
+        t32 = frames['time_us'].astype(np.int64)
+        prev = np.concatenate(([t32[0] if self._last_time_u32 is None else self._last_time_u32], t32[:-1]))
+        wraps = self._time_wraps + np.cumsum((t32 - prev) < -(1 << 31))
+        self._time_wraps = int(wraps[-1])
+        self._last_time_u32 = int(t32[-1])
+
+        records['t_host'] = t_host
+        records['time_us'] = t32 + (wraps << 32)
+        records['type'] = frames['type']
+        records['sensor'] = frames['sensor']
+        records['seq'] = frames['seq']
+        records['raw_z'] = frames['z']
+        records['range'] = frames['range']
+        records['z_mT'] = raw_z_to_mT(frames['z'], frames['range'], self.z_offset[frames['sensor'] % MAX_SENSORS])
+        records['force_n'] = self.force_fn(records['z_mT']) if self.force_fn else np.nan
+        return records
+
+    def _text_records(self, matches, t_host):
+        records = np.zeros(len(matches), dtype=SAMPLE_DTYPE)
+        if not matches:
+            return records
+        fields = np.array(matches, dtype='S24')     # labels, z, force as columns
+        labels, force = fields[:, 0], fields[:, 2]
+        labels[labels == b''] = b'1'                # "Z-axis: 12.693" is M1
+        force[force == b''] = b'nan'
+        records['t_host'] = t_host
+        records['time_us'] = int(t_host * 1e6)
+        records['type'] = FRAME_TYPE_SAMPLE
+        records['sensor'] = labels.astype(np.int64) - 1
+        records['z_mT'] = fields[:, 1].astype(np.float32)
+        force = force.astype(np.float32)
+        if self.force_fn and np.isnan(force).any():
+            force = np.where(np.isnan(force), self.force_fn(records['z_mT']), force)
+        records['force_n'] = force
+        return records
@@ -0,0 +1,196 @@
+"""
+Long-duration recorder for the Pico force sensor stream.
+
+Samples from pico_stream are appended to a single .npy file of
+pico_stream.SAMPLE_DTYPE records (time_us, t_host, sensor, type, seq,
+raw_z, range, z_mT, force_n; force_n is NaN for binary frames, apply the
+calibration model to z_mT offline). The header is written with a fixed-width
+record count that is updated in place after each flush, so the file is a
+standard .npy at all times:
+
+    log = np.load('force_log.npy', mmap_mode='r')   # no data loaded yet
+    force = log['force_n'][-60000:]                 # just the last minute at 1 kHz
+
+Writes are buffered and flushed (with fsync) every FLUSH_S seconds or
+BUFFER_SAMPLES samples. The count is only advanced once the data is on
+disk, and reopening a file truncates a half-written record, so a crash
+loses at most the unflushed buffer.
+
+Run standalone to record until Ctrl+C:
+
+    python recorder.py
+"""
+
+import os
+import struct
+import time
+
+import numpy as np
+import serial
+from pico_stream import PicoStream, SAMPLE_DTYPE
+
+# ========================================
+# RECORDER CONFIGURATION
+# ========================================
+SERIAL_PORT = 'COM4'  # Change to your Pico's COM port
+BAUD_RATE = 115200
+OUTPUT_FORMAT = 'binary'  # 'binary' keeps device timestamps and raw counts; set on the Pico at start
+Z_AXIS_KEYWORD = "Z-axis"
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+RECORD_DIR = os.path.join(SCRIPT_DIR, 'recordings')
+
+FLUSH_S = 1.0               # Longest time data waits in memory
+BUFFER_SAMPLES = 1 << 16    # Flush early once this many samples are buffered
+HEADER_LEN = 512            # Bytes of .npy header (magic + length + dict), multiple of 64
+NPY_MAGIC = b'\x93NUMPY\x01\x00'
+
+
+def _npy_header(dtype, count):
+    """Version 1.0 .npy header with a fixed-width count, so it can be rewritten in place."""
+    text = "{'descr': %r, 'fortran_order': False, 'shape': (%20d,), }" % (
+        np.lib.format.dtype_to_descr(dtype), count)
+    pad = HEADER_LEN - len(NPY_MAGIC) - 2 - len(text) - 1
+    if pad < 0:
+        raise ValueError("record dtype too large for HEADER_LEN")
+    text += ' ' * pad + '\n'
+    return NPY_MAGIC + struct.pack('<H', len(text)) + text.encode('latin1')
+
+
+class Recorder:
+    """
+    Append-only .npy log.
+
+    Args:
+        path: File to create, or to continue if it already holds a log of the same dtype
+        dtype: Record dtype
+    """
+
+    def __init__(self, path, dtype=SAMPLE_DTYPE, flush_s=FLUSH_S, buffer_samples=BUFFER_SAMPLES):
+        self.path = path
+        self.dtype = np.dtype(dtype)
+        self.flush_s = flush_s
+        self.buffer = np.zeros(buffer_samples, dtype=self.dtype)
+        self.buffered = 0
+        self.count = 0              # Records on disk
+        self.last_flush = time.time()
+
+        if os.path.exists(path) and os.path.getsize(path) >= HEADER_LEN:
+            self.file = open(path, 'r+b')
+            self._recover()
+        else:
+            self.file = open(path, 'w+b')
+            self.file.write(_npy_header(self.dtype, 0))
+            self._sync()
+
+    def _recover(self):
+        """Resume an existing log: recount the records and drop a partial one."""
+        header = self.file.read(HEADER_LEN)
+        if not header.startswith(NPY_MAGIC) or header != _npy_header(self.dtype, self._header_count(header)):
+            raise ValueError(f"{self.path} is not a recorder log with this record format")
+        size = os.fstat(self.file.fileno()).st_size
+        self.count = (size - HEADER_LEN) // self.dtype.itemsize
+        self.file.truncate(HEADER_LEN + self.count * self.dtype.itemsize)
+        self._write_count()
+
+    @staticmethod
+    def _header_count(header):
+        start = header.index(b"'shape': (") + len(b"'shape': (")
+        return int(header[start:header.index(b',)', start)])
+
+    def _sync(self):
+        self.file.flush()
+        os.fsync(self.file.fileno())
+
+    def _write_count(self):
+        self.file.seek(0)
+        self.file.write(_npy_header(self.dtype, self.count))
+        self._sync()
+        self.file.seek(0, os.SEEK_END)
+
+    def append(self, records):
+        """Buffer records (an array of the record dtype); flushes as needed."""
+        while len(records):
+            n = min(len(records), len(self.buffer) - self.buffered)
+            self.buffer[self.buffered:self.buffered + n] = records[:n]
+            self.buffered += n
+            records = records[n:]
+            if self.buffered == len(self.buffer):
+                self.flush()
+        if self.buffered and time.time() - self.last_flush >= self.flush_s:
+            self.flush()
+
+    def flush(self):
+        """Write the buffer, make it durable, then advance the record count."""
+        self.last_flush = time.time()
+        if self.buffered == 0:
+            return
+        self.file.seek(HEADER_LEN + self.count * self.dtype.itemsize)
+        self.file.write(self.buffer[:self.buffered].tobytes())
+        self._sync()
+        self.count += self.buffered
+        self.buffered = 0
+        self._write_count()
+
+    def close(self):
+        self.flush()
+        self.file.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+
+def open_log(path):
+    """
+    Memory-map a log for analysis (also works while it is being recorded).
+
+    Returns: read-only structured array, fields as pico_stream.SAMPLE_DTYPE
+    """
+    return np.load(path, mmap_mode='r')
+
+
+def main():
+    print("=" * 70)
+    print("RASPBERRY PI PICO - FORCE DATA RECORDER")
+    print("=" * 70)
+
+    os.makedirs(RECORD_DIR, exist_ok=True)
+    path = os.path.join(RECORD_DIR, time.strftime('force_%Y%m%d_%H%M%S.npy'))
+
+    print(f"\nConnecting to Pico on {SERIAL_PORT}...")
+    try:
+        stream = PicoStream(SERIAL_PORT, BAUD_RATE, keyword=Z_AXIS_KEYWORD).start()
+    except serial.SerialException as e:
+        print(f"✗ Error: Could not open serial port {SERIAL_PORT}")
+        print(f"  {e}")
+        return
+    reply = stream.set_output_format(OUTPUT_FORMAT)
+    print(f"✓ Connected! ({reply})")
+
+    print(f"\nRecording to '{path}'")
+    print("Press Ctrl+C to stop.\n")
+    next_report = time.time() + 10
+    lost_total = 0
+    with Recorder(path) as recorder:
+        cursor = stream.cursor()
+        try:
+            while True:
+                time.sleep(0.1)
+                samples, cursor, lost = stream.read_since(cursor)
+                lost_total += lost
+                recorder.append(samples)
+                if time.time() >= next_report:
+                    next_report += 10
+                    print(f"  {recorder.count + recorder.buffered} samples, {lost_total} lost", end='\r')
+        except KeyboardInterrupt:
+            pass
+        finally:
+            stream.close()
+
+    print(f"\n✓ {recorder.count} samples saved to '{path}'")
+
+
+if __name__ == "__main__":
+    main()
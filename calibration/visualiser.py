@@ -6,8 +6,8 @@ import os
 import json
 import numpy as np
 import matplotlib.pyplot as plt
-from matplotlib.animation import FuncAnimation
-import re
+from pico_stream import PicoStream, evaluate_model
+from recorder import Recorder
 
 # ========================================
 # SENSOR MAPPING CONFIGURATION
@@ -18,6 +18,13 @@ Z_AXIS_KEYWORD = "Z-axis"        # Keyword for Z-axis sensor
 # Serial configuration
 SERIAL_PORT = 'COM4'  # Change to your Pico's COM port
 BAUD_RATE = 115200
+OUTPUT_FORMAT = 'text'  # 'text' or 'binary', must match OUTPUT_FORMAT_DEFAULT in firmware
+
+# Display configuration
+FRAME_RATE_HZ = 30      # Redraws per second, independent of the sample rate
+WINDOW_S = 10.0         # Seconds of history in the time plot
+PLOT_BINS = 800         # Min/max bins across the time plot (about its width in pixels)
+RECORD_FILE = None      # e.g. 'session.npy' to also log every sample (see recorder.py)
 
 # Get script directory for calibration file
 SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
@@ -27,33 +34,6 @@ CALIBRATION_FILE = os.path.join(SCRIPT_DIR, 'calibration_data.json')
 # HELPER FUNCTIONS
 # ========================================
 
-def extract_sensor_value(line, keyword):
-    """
-    Extract sensor value from serial output.
-    
-    Handles formats like:
-    - "Current(M1): 0.013 A"
-    - "Z-axis(M1): 12.693 mT"
-    
-    Returns: value or None
-    """
-    if keyword not in line:
-        return None
-    
-    try:
-        # Pattern: Keyword(optional_label): value unit
-        pattern = rf"{keyword}\(?([^)]*)\)?:\s*([-+]?\d+\.?\d*)"
-        match = re.search(pattern, line)
-        
-        if match:
-            value = float(match.group(2))
-            return value
-        
-        return None
-    except (ValueError, IndexError):
-        return None
-
-
 def load_calibration():
     """
     Load calibration constants from JSON file.
@@ -78,43 +58,77 @@ def load_calibration():
         return None
 
 
-def read_sensor_values(ser):
-    """
-    Read Z-axis sensor value from serial.
-    
-    Returns: z_axis_value or None
-    """
-    while True:
-        try:
-            line = ser.readline().decode('utf-8').strip()
-            if not line:
-                continue
-            
-            z_axis_val = extract_sensor_value(line, Z_AXIS_KEYWORD)
-            
-            # Return if we got valid data
-            if z_axis_val is not None:
-                return z_axis_val
-        
-        except (ValueError, UnicodeDecodeError, AttributeError):
-            continue
-
-
 def calculate_force(z_value, z_calib):
     """
-    Convert Z-axis reading to force in Newtons (clamped to non-negative).
+    Convert Z-axis readings to force in Newtons (clamped to non-negative).
     
     Args:
-        z_value: Z-axis sensor reading
-        z_calib: Calibration data dict with slope and intercept
+        z_value: Z-axis sensor reading, or an array of them
+        z_calib: Calibration data dict with slope and intercept, and
+                 optionally a higher order "model" that takes precedence
     
-    Returns: Force in Newtons (>= 0)
+    Returns: Force in Newtons (>= 0), same shape as z_value
     """
     if z_value is None or z_calib is None:
         return None
     
-    force = (z_calib['slope'] * z_value) + z_calib['intercept']
-    return max(0, force)  # Clamp to zero if negative
+    if 'model' in z_calib:
+        force = evaluate_model(z_calib['model'], z_value)
+    else:
+        force = (z_calib['slope'] * np.asarray(z_value)) + z_calib['intercept']
+    return np.maximum(0, force)  # Clamp to zero if negative
+
+
+def minmax_decimate(t, y, t_start, t_end, bins):
+    """
+    Reduce a time series to the min and max of each of `bins` equal time
+    slots, so spikes survive however many samples land in one pixel.
+    t must be sorted.
+    
+    Returns: (x, y) with two points per non-empty slot
+    """
+    if len(t) == 0:
+        return np.zeros(0), np.zeros(0)
+    edges = np.searchsorted(t, np.linspace(t_start, t_end, bins + 1))
+    starts = np.unique(edges[:-1][edges[:-1] < len(t)])
+    y_min = np.minimum.reduceat(y, starts)
+    y_max = np.maximum.reduceat(y, starts)
+    x = np.repeat(t[starts], 2)
+    out = np.empty(2 * len(starts))
+    out[0::2] = y_min
+    out[1::2] = y_max
+    return x, out
+
+
+class BlitManager:
+    """
+    Redraw only the animated artists on top of a cached background.
+    Any full draw (resize, axis limit change) recaptures the background.
+    """
+    
+    def __init__(self, canvas, artists):
+        self.canvas = canvas
+        self.artists = artists
+        self.background = None
+        for artist in artists:
+            artist.set_animated(True)
+        canvas.mpl_connect("draw_event", self._on_draw)
+    
+    def _on_draw(self, event):
+        self.background = self.canvas.copy_from_bbox(self.canvas.figure.bbox)
+        self._draw_artists()
+    
+    def _draw_artists(self):
+        for artist in self.artists:
+            self.canvas.figure.draw_artist(artist)
+    
+    def update(self):
+        if self.background is None:
+            return
+        self.canvas.restore_region(self.background)
+        self._draw_artists()
+        self.canvas.blit(self.canvas.figure.bbox)
+        self.canvas.flush_events()
 
 
 def main():
@@ -142,9 +156,8 @@ def main():
     # Connect to Pico
     print(f"\nConnecting to Pico on {SERIAL_PORT}...")
     try:
-        ser = serial.Serial(SERIAL_PORT, BAUD_RATE, timeout=1)
-        time.sleep(2)
-        ser.reset_input_buffer()
+        stream = PicoStream(SERIAL_PORT, BAUD_RATE, output_format=OUTPUT_FORMAT, keyword=Z_AXIS_KEYWORD,
+                            force_fn=lambda z: calculate_force(z, z_axis_calib)).start()
         print("✓ Connected!\n")
     except serial.SerialException as e:
         print(f"✗ Error: Could not open serial port {SERIAL_PORT}")
@@ -154,22 +167,28 @@ def main():
     print("Starting real-time visualization...")
     print("Close the plot window to stop.\n")
     
-    # Initialize data storage
-    force_values = [0]
-    z_axis_values = [0]
+    # Full-rate history of the time window; everything else stays in the stream's ring
+    window_t = np.zeros(0)
+    window_z = np.zeros(0)
+    cursor = stream.cursor()
+    lost_total = [0]
     max_force = [1.0]  # For auto-scaling
+    recorder = Recorder(RECORD_FILE) if RECORD_FILE else None
+    if recorder:
+        print(f"Recording every sample to '{RECORD_FILE}'\n")
     
     # Set up the plot
-    fig = plt.figure(figsize=(12, 5))
+    fig = plt.figure(figsize=(12, 8))
     fig.suptitle('Raspberry Pi Pico - Z-Axis Force Measurement', 
                  fontsize=16, fontweight='bold')
     
-    # Create subplots for Z-axis and Force
-    ax_z = fig.add_subplot(1, 2, 1)
-    ax_force = fig.add_subplot(1, 2, 2)
+    # Bars for the newest reading, time plot of the window below
+    ax_z = fig.add_subplot(2, 2, 1)
+    ax_force = fig.add_subplot(2, 2, 2)
+    ax_time = fig.add_subplot(2, 1, 2)
     
     # Configure Z-axis
-    bar_z = ax_z.barh(['Z-axis'], [0], color='mediumseagreen', height=0.5)
+    bar_z = ax_z.barh(['Z-axis'], [0], color='mediumseagreen', height=0.5)[0]
     ax_z.set_xlabel('Z-axis (mT)', fontsize=11)
     ax_z.set_xlim(0, 50)
     ax_z.grid(True, alpha=0.3, axis='x')
@@ -181,7 +200,7 @@ def main():
                                facecolor='mediumseagreen', alpha=0.8))
     
     # Configure Force
-    bar_force = ax_force.barh(['Force'], [0], color='crimson', height=0.5)
+    bar_force = ax_force.barh(['Force'], [0], color='crimson', height=0.5)[0]
     ax_force.set_xlabel('Force (N)', fontsize=11)
     ax_force.set_xlim(0, 1.0)
     ax_force.grid(True, alpha=0.3, axis='x')
@@ -192,55 +211,90 @@ def main():
                                bbox=dict(boxstyle='round,pad=0.5', 
                                         facecolor='crimson', alpha=0.8))
     
+    # Configure the time plot (min/max envelope of the force)
+    (force_line,) = ax_time.plot([], [], color='crimson', linewidth=1)
+    ax_time.set_xlabel('Time (s)', fontsize=11)
+    ax_time.set_ylabel('Force (N)', fontsize=11)
+    ax_time.set_xlim(-WINDOW_S, 0)
+    ax_time.set_ylim(0, 1.0)
+    ax_time.grid(True, alpha=0.3)
+    rate_text = ax_time.text(0.01, 0.95, '', transform=ax_time.transAxes,
+                             fontsize=10, ha='left', va='top')
+    
     plt.tight_layout()
+    blit = BlitManager(fig.canvas, [bar_z, z_text, bar_force, force_text, force_line, rate_text])
     
-    def update_plot(frame):
-        """Update plot with new sensor data."""
+    def update_plot():
+        """Take in everything that arrived since the last frame and redraw."""
+        nonlocal window_t, window_z, cursor
         try:
-            # Read new Z-axis data
-            z_axis_val = read_sensor_values(ser)
+            samples, cursor, lost = stream.read_since(cursor)
+            if recorder:
+                recorder.append(samples)
+            if lost:
+                lost_total[0] += lost
+                print(f"⚠ Display fell behind, {lost} samples skipped")
+            
+            if len(samples):
+                # Binary frames carry the device clock, text lines the PC receive time
+                t = samples['time_us'] / 1e6
+                window_t = np.concatenate((window_t, t))
+                window_z = np.concatenate((window_z, samples['z_mT'].astype(float)))
+                keep = window_t >= window_t[-1] - WINDOW_S
+                window_t = window_t[keep]
+                window_z = window_z[keep]
+            if len(window_t) == 0:
+                return
             
-            # Update Z-axis and force
-            if z_axis_val is not None:
-                z_axis_values[0] = z_axis_val
-                force_n = calculate_force(z_axis_val, z_axis_calib)
-                if force_n is not None:
-                    force_values[0] = force_n
-                    
-                    # Update max force for auto-scaling
-                    if force_n > max_force[0]:
-                        max_force[0] = force_n * 1.1
-                        ax_force.set_xlim(0, max_force[0])
+            full_redraw = False
+            z_now = window_z[-1]
+            force_now = float(calculate_force(z_now, z_axis_calib))
+            bar_z.set_width(z_now)
+            z_text.set_text(f'{z_now:.3f} mT')
+            bar_force.set_width(force_now)
+            force_text.set_text(f'{force_now:.3f} N\n{force_now / 9.81:.4f} kg')
             
-            # Update Z-axis display
-            bar_z_list = [bar for bar in ax_z.patches]
-            if bar_z_list:
-                bar_z_list[0].set_width(z_axis_values[0])
-            z_text.set_text(f'{z_axis_values[0]:.3f} mT')
+            t_end = window_t[-1]
+            x, y = minmax_decimate(window_t - t_end, calculate_force(window_z, z_axis_calib),
+                                   -WINDOW_S, 0.0, PLOT_BINS)
+            force_line.set_data(x, y)
+            span = window_t[-1] - window_t[0]
+            rate = (len(window_t) - 1) / span if span > 0 else 0.0
+            rate_text.set_text(f'{rate:.0f} samples/s, {len(window_t)} in view')
             
-            # Update force display
-            bar_force_list = [bar for bar in ax_force.patches]
-            if bar_force_list:
-                bar_force_list[0].set_width(force_values[0])
-            force_kg = force_values[0] / 9.81
-            force_text.set_text(f'{force_values[0]:.3f} N\n{force_kg:.4f} kg')
+            # Update max force for auto-scaling (axis changes need a full redraw)
+            peak = max(force_now, float(y.max()) if len(y) else 0.0)
+            if peak > max_force[0]:
+                max_force[0] = peak * 1.1
+                ax_force.set_xlim(0, max_force[0])
+                ax_time.set_ylim(0, max_force[0])
+                full_redraw = True
             
-            return bar_z_list + bar_force_list
+            if full_redraw:
+                fig.canvas.draw_idle()
+            else:
+                blit.update()
         
         except Exception as e:
             print(f"Error updating plot: {e}")
-            return []
     
-    # Create animation
-    anim = FuncAnimation(fig, update_plot, interval=50, blit=False, 
-                        cache_frame_data=False)
+    # Fixed frame rate, the reader thread keeps collecting meanwhile
+    timer = fig.canvas.new_timer(interval=int(1000 / FRAME_RATE_HZ))
+    timer.add_callback(update_plot)
+    timer.start()
     
     try:
         plt.show()
     except KeyboardInterrupt:
         pass
     finally:
-        ser.close()
+        timer.stop()
+        stream.close()
+        if recorder:
+            recorder.close()
+            print(f"✓ {recorder.count} samples saved to '{RECORD_FILE}'")
+        if lost_total[0]:
+            print(f"  {lost_total[0]} samples were never displayed.")
         print("\n✓ Serial connection closed.")
 
 
@@ -1,7 +1,24 @@
 #include <stdio.h>
 #include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "force_sensor_config.h"    // Generated by CMake: fixed config and host replay options
+#if FORCE_SENSOR_HOST
+#include "pico_host.h"              // SDK subset for the host replay build, see host/
+#else
 #include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "pico/stdio_usb.h"
 #include "hardware/i2c.h"
+#include "hardware/sync.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/flash.h"
+#include "hardware/watchdog.h"
+#include "hardware/clocks.h"
+#include "hardware/structs/systick.h"
+#endif
 
 // ========================================
 // CONFIGURATION
@@ -13,24 +30,223 @@
 #define I2C_PORT i2c0
 #define I2C_SDA_PIN 4
 #define I2C_SCL_PIN 5
+#define I2C1_PORT i2c1            // Second bus, only set up if a sensor uses it
+#define I2C1_SDA_PIN 14
+#define I2C1_SCL_PIN 15
 #define I2C_FREQ 400000
+#define I2C_TIMEOUT_US 2000       // Per-transfer timeout for I2C reads/writes
+
+// MLX90393 INT/DRDY output of M1 (used in burst mode)
+#define MLX_DRDY_PIN 6
+#define MLX_NO_DRDY -1            // drdy_pin value for sensors without INT wired
 
 // MLX90393 I2C Address and Commands
 #define MLX90393_ADDR 0x0C
+#define MLX90393_REG_SB 0x10      // Start burst mode
+#define MLX90393_REG_SW 0x20      // Start wake-up on change mode
 #define MLX90393_REG_SM 0x30      // Start single measurement
 #define MLX90393_REG_RM 0x40      // Read measurement
+#define MLX90393_REG_RR 0x50      // Read register
+#define MLX90393_REG_WR 0x60      // Write register
 #define MLX90393_REG_EX 0x80      // Exit mode
 #define MLX90393_REG_RT 0xF0      // Reset
-#define MLX90393_AXIS_ALL 0x0E
+#define MLX90393_AXIS_T 0x01
+#define MLX90393_AXIS_X 0x02
+#define MLX90393_AXIS_Y 0x04
+#define MLX90393_AXIS_Z 0x08
+#define MLX90393_AXIS_ALL 0x0E          // X | Y | Z
+#define MLX90393_AXIS_TXYZ 0x0F
+#define MLX90393_RESPONSE_MAX 9         // Status + T, X, Y, Z
+#define MLX90393_TEMP_RAW_REF 46244     // Raw T at MLX90393_TEMP_REF_C (datasheet)
+#define MLX90393_TEMP_REF_C 35.0f
+#define MLX90393_TEMP_LSB_PER_C 45.2f
+
+// MLX90393 status byte
+#define MLX90393_STATUS_BURST 0x80
+#define MLX90393_STATUS_WOC 0x40
+#define MLX90393_STATUS_MODE_MASK 0xE0    // BURST | WOC | SM
+#define MLX90393_STATUS_ERROR 0x10
+#define MLX90393_STATUS_SED 0x08          // Single error detected (and corrected) in memory
+#define MLX90393_STATUS_RS 0x04           // Sensor has been reset
+
+// MLX90393 configuration registers (volatile, lost on reset)
+#define MLX90393_CONF1 0x00               // Z_SERIES | GAIN_SEL | HALLCONF
+#define MLX90393_CONF2 0x01               // TRIG_INT | COMM_MODE | WOC_DIFF | EXT_TRG | TCMP_EN | BURST_SEL | BURST_DATA_RATE
+#define MLX90393_CONF3 0x02               // OSR2 | RES_Z | RES_Y | RES_X | DIG_FILT | OSR
+#define MLX90393_HALLCONF_MASK 0x000F
+#define MLX90393_HALLCONF_DEFAULT 0x000C  // Matches mlx90393_lsb_lookup[0]
+#define MLX90393_GAIN_SHIFT 4
+#define MLX90393_GAIN_MASK 0x0070
+#define MLX90393_OSR_SHIFT 0
+#define MLX90393_DIG_FILT_SHIFT 2
+#define MLX90393_RES_X_SHIFT 5
+#define MLX90393_RES_Y_SHIFT 7
+#define MLX90393_RES_Z_SHIFT 9
+#define MLX90393_OSR2_SHIFT 11
+#define MLX90393_CONF3_MASK 0x1FFF
+#define MLX90393_WOXY_THRESHOLD 0x07
+#define MLX90393_WOZ_THRESHOLD 0x08
+#define MLX90393_BURST_RATE_MASK 0x003F   // Burst/WOC conversion interval in 20 ms steps, 0 = back-to-back
+#define MLX90393_BURST_RATE_STEP_MS 20
+#define MLX90393_WOC_DIFF 0x1000          // Compare against the previous conversion instead of the first
+
+// Conversion timing
+#define MLX_CONV_OVERHEAD_US 500      // Standby + active + end-of-conversion time per SM
+#define MLX_CONV_TIMEOUT_US 2000      // Extra time allowed past the expected conversion end
+#define MLX_POLL_INTERVAL_US 100      // Retry interval while waiting for data
+
+// Auto-range (per sensor, see mlx_dev_t.auto_range)
+#define AUTORANGE_HIGH_PCT 85         // Step to a lower gain above this share of full scale
+#define AUTORANGE_LOW_PCT 55          // Step back up only if the higher gain stays below this
+#define AUTORANGE_HOLD_SAMPLES 32     // Consecutive small samples needed before stepping up
+#if FIXED_PROCESSING
+#define TEMP_EVERY_DEFAULT 0          // Nothing uses T without the calibration's temperature model
+#else
+#define TEMP_EVERY_DEFAULT 16         // Add T to every Nth single measurement, 0 = never
+#endif
+
+// Acquisition mode at boot (ACQ_MODE_SINGLE or ACQ_MODE_BURST)
+// Burst mode needs the sensor INT/DRDY pin wired to MLX_DRDY_PIN
+#define ACQ_MODE_DEFAULT ACQ_MODE_SINGLE
+
+// Adaptive power ("power adaptive"): wake-on-change while the force is idle
+#define POWER_IDLE_MS 2000            // No change for this long drops to wake-on-change
+#define POWER_IDLE_BAND_MT 0.05f      // Z movement that counts as activity
+#define POWER_WAKE_MT 0.1f            // Z change that wakes the sensor (WOZ_THRESHOLD)
+#define POWER_WOC_PERIOD_MS 20        // Sensor's own conversion interval while idle (20 ms steps)
+#define POWER_IDLE_PERIOD_US 200000   // Core1 housekeeping tick while idle, and single mode rate without DRDY
+#define POWER_WOC_PROBE_TICKS 5       // Ticks between RM checks in WOC until a sensor's DRDY has been seen
+
+// Fault recovery (core1 supervisor)
+#define SUPERVISOR_PERIOD_MS 100      // Fault checks and watchdog feed
+#define SUPERVISOR_FAIL_LIMIT 10      // Consecutive failed measurements before a sensor is reinitialised
+#define SUPERVISOR_BACKOFF_MIN_MS 100 // First retry after a failed reinit, doubling from there
+#define SUPERVISOR_BACKOFF_MAX_MS 10000
+#define SUPERVISOR_BUS_RESET_AFTER 2  // Failed reinits of a sensor before its bus is reset as well
+#define I2C_RECOVERY_CLOCKS 9         // SCL pulses that free any byte a sensor was sending
+#define I2C_RECOVERY_HALF_US 5        // Half period of those pulses (100kHz)
+#define WATCHDOG_TIMEOUT_MS 3000      // Reboot if core1's loop stops for this long (max 8388)
+
+// Default calibration (from calibration_data.json), used until a
+// calibration is committed to flash with the "cal" commands. A fixed
+// config build (FIXED_SENSOR_CONFIG) takes these from CMake instead,
+// together with the gain, resolution and EMA weight, for every sensor
+#if FIXED_SENSOR_CONFIG
+#define CALIBRATION_SLOPE FIXED_CAL_SLOPE
+#define CALIBRATION_INTERCEPT FIXED_CAL_INTERCEPT
+#define Z_OFFSET_MT FIXED_Z_OFFSET_MT
+#else
+#define CALIBRATION_SLOPE 16.919685542455237f
+#define CALIBRATION_INTERCEPT -259.53500156355966f
+#define Z_OFFSET_MT 20.0f         // Zero offset added to Z until the sensor is tared
+#endif
+
+// On-device calibration
+#define KG_TO_NEWTONS 9.80665f
+#define CAL_MAX_POINTS 16             // Weight points per sensor
+#define CAL_SAMPLES_PER_POINT 50      // Raw samples averaged for each point
+#define CAL_POLY_MAX_COEFFS 6         // Up to 5th order polynomial models
+#define CAL_LUT_SIZE 65               // Force LUT entries over the calibrated Z span
+#define CAL_DEFAULT_SPAN_MT 100.0f    // LUT span for the compiled-in linear model
+#define CAL_TEMP_MIN_SPAN_C 2.0f      // Temperature swing a "cal temp" run needs for a fit
+#define TARE_SAMPLES 50               // Readings averaged by "tare"
+#define TARE_TRACK_BAND_MT 0.1f       // Baseline tracking only acts this close to the zero-force Z
+#define TARE_TRACK_QUIET_MT 0.02f     // ... and while the mean deviation of Z stays below this
+#define TARE_TRACK_WINDOW 64          // EMA length of the tracker's mean and deviation (samples)
+#define TARE_TRACK_SHIFT 10           // Offset moves 1/2^SHIFT of the error per quiet sample
+
+// Calibration storage in the last flash sector (outside the program image)
+#define CAL_STORE_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+#define CAL_STORE_MAGIC 0x4C414346    // "FCAL"
+#define CAL_STORE_VERSION 4
+#define CAL_STORE_MAX_SENSORS 8
+#define CAL_STORE_SAVE_MIN_MS 1000    // Shortest interval between writes of a tare finished by the sample path
+
+// Filter settings (defaults of each sensor's chain, see filter_config_t)
+#if FIXED_SENSOR_CONFIG
+#define FILTER_VAL FIXED_FILTER_EMA
+#else
+#define FILTER_VAL 0.4f               // EMA weight of the previous output, 0 = off
+#endif
+#define FILTER_MEDIAN_MAX 7           // Longest median window (odd)
+#define FILTER_MEAN_MAX 64            // Longest moving-average window
+#define FILTER_Q_DEFAULT 0.7071f      // Butterworth
+#define FILTER_NOTCH_Q_DEFAULT 5.0f
+#define FILTER_RATE_WINDOW 64         // Samples per sample-rate measurement
+#define FILTER_RATE_TOLERANCE 0.05f   // Redesign the biquad if the rate moves this much
+
+// Numeric pipeline: 0 = float, 1 = Q16.16 fixed point (no soft-float per sample)
+#define USE_FIXED_POINT 0
+
+// Sampling
+#define SAMPLE_PERIOD_US 100000       // Single mode sample period at boot (10Hz)
+#define SAMPLE_PERIOD_MAX_US 10000000 // Slowest rate the "rate" command accepts (0.1Hz)
+#define SAMPLE_TIMER_ALARM 2          // Hardware alarm for core1's pacing timer (the SDK's default pool uses 3)
+#define JITTER_BINS 16                // Histogram of interval - nominal period
+#define JITTER_BIN_US 20
+#define SAMPLE_RING_SIZE 256          // Core1 -> core0 sample queue (power of two)
+#define HISTORY_SIZE 2048             // Raw sample history kept for "dump" (power of two)
+
+// Trigger capture ("trigger" command)
+#define TRIGGER_WINDOW_MAX 512        // Pre + post samples per event
+#define TRIGGER_PRE_DEFAULT 100
+#define TRIGGER_POST_DEFAULT 400
+#define TRIGGER_IDLE_HZ 10.0f         // Stream rate between events while armed
+
+// Benchmark ("bench" command)
+#define BENCH_DEFAULT_ITER 100
+#define BENCH_MAX_ITER 500            // Cycle counts kept per stage for the p99
 
-// Calibration Constants (from calibration_data.json)
-// UPDATE THESE VALUES AFTER RUNNING CALIBRATION
-#define CALIBRATION_SLOPE 51.94029384743018f
-#define CALIBRATION_INTERCEPT -692.9925307532482f
-#define Z_OFFSET_MT 20.0f         // Offset to keep Z-axis values positive
+// Command input
+#define CMD_LINE_MAX 160             // Fits a "cal <n> poly" upload
 
-// Filter settings
-#define FILTER_VAL 0.4f
+// Output format at boot (OUTPUT_FORMAT_TEXT or OUTPUT_FORMAT_BINARY)
+#define OUTPUT_FORMAT_DEFAULT OUTPUT_FORMAT_TEXT
+
+// USB output batching: samples are collected and written to the CDC port in
+// one go once OUTPUT_BATCH_SAMPLES are in or the oldest has waited OUTPUT_BATCH_US
+#define OUTPUT_BUF_SIZE 1024          // Bytes per write (a frame is 20, a text line ~50)
+#define OUTPUT_BATCH_SAMPLES 16       // At boot, 1 = write each sample straight away
+#define OUTPUT_BATCH_US 20000         // Longest a sample waits in the batch
+#define OUTPUT_EOL "\r\n"             // Line ending of batched text (what stdio's CRLF translation sends)
+
+// Binary frame markers
+#define FRAME_SYNC0 0xA5
+#define FRAME_SYNC1 0x5A
+#define FRAME_TYPE_SAMPLE 0x01
+#define FRAME_TYPE_HISTORY 0x02       // Sample replayed from the history buffer
+#define FRAME_TYPE_EVENT 0x03         // Sample from a trigger capture window
+
+// ========================================
+// NUMERIC TYPES
+// ========================================
+// value_t carries mT, filter state and force through the processing chain.
+// VALUE_FROM_FLOAT is meant for constants and configuration, not per sample.
+#if USE_FIXED_POINT
+typedef int32_t value_t;                    // Q16.16
+#define VALUE_FRAC_BITS 16
+#define VALUE_ONE (1 << VALUE_FRAC_BITS)
+#define VALUE_FROM_FLOAT(f) ((value_t)((f) * VALUE_ONE + (((f) < 0) ? -0.5f : 0.5f)))
+#define VALUE_TO_FLOAT(v) ((float)(v) / VALUE_ONE)
+#define VALUE_MUL(a, b) ((value_t)(((int64_t)(a) * (b)) >> VALUE_FRAC_BITS))
+#define VALUE_FROM_INT(i) ((value_t)(i) * VALUE_ONE)
+#define VALUE_FLOOR(v) ((int32_t)((v) >> VALUE_FRAC_BITS))
+typedef int64_t value_acc_t;                // Sums of value_t
+typedef int32_t coeff_t;                    // Filter coefficients, Q2.30 (|c| <= 2)
+#define COEFF_FRAC_BITS 30
+#define COEFF_FROM_FLOAT(f) ((coeff_t)((f) * (float)(1 << COEFF_FRAC_BITS)))
+#else
+typedef float value_t;
+#define VALUE_ONE 1.0f
+#define VALUE_FROM_FLOAT(f) ((value_t)(f))
+#define VALUE_TO_FLOAT(v) (v)
+#define VALUE_MUL(a, b) ((a) * (b))
+#define VALUE_FROM_INT(i) ((value_t)(i))
+#define VALUE_FLOOR(v) ((int32_t)floorf(v))
+typedef float value_acc_t;
+typedef float coeff_t;
+#define COEFF_FROM_FLOAT(f) (f)
+#endif
 
 // ========================================
 // GAIN AND RESOLUTION SETTINGS
@@ -53,6 +269,442 @@ typedef enum {
     MLX90393_RES_19 = 3
 } mlx90393_resolution_t;
 
+typedef enum {
+    MLX90393_OSR_0 = 0,
+    MLX90393_OSR_1 = 1,
+    MLX90393_OSR_2 = 2,
+    MLX90393_OSR_3 = 3
+} mlx90393_osr_t;
+
+typedef enum {
+    MLX90393_FILTER_0 = 0,
+    MLX90393_FILTER_1 = 1,
+    MLX90393_FILTER_2 = 2,
+    MLX90393_FILTER_3 = 3,
+    MLX90393_FILTER_4 = 4,
+    MLX90393_FILTER_5 = 5,
+    MLX90393_FILTER_6 = 6,
+    MLX90393_FILTER_7 = 7
+} mlx90393_filter_t;
+
+// Range byte carried with every sample: selects the LSB for conversion
+#define MLX_RANGE(gain, res) ((uint8_t)(((gain) << 2) | (res)))
+#define MLX_RANGE_COUNT 32
+
+// Sensor settings written to CONF1/CONF3 by mlx_configure()
+typedef struct {
+    uint8_t axes;               // MLX90393_AXIS_* measured by SM/SB/RM, must include Z
+    mlx90393_gain_t gain;
+    mlx90393_resolution_t res;  // Used for all three axes
+    mlx90393_osr_t osr;         // Magnetic oversampling
+    mlx90393_osr_t osr2;        // Temperature oversampling
+    mlx90393_filter_t dig_filt;
+} mlx_config_t;
+
+typedef enum {
+    CAL_MODEL_POLY = 0,         // coeffs = c0, c1, ... for c0 + c1*z + c2*z^2 ... (linear: 2)
+    CAL_MODEL_PWL = 1           // coeffs = z0, f0, z1, f1, ... knots with z ascending
+} cal_model_type_t;
+
+// Force (N) as a function of Z (mT), as committed to flash
+#define CAL_VALID 0x01
+typedef struct {
+    uint8_t type;               // cal_model_type_t
+    uint8_t count;              // Coefficients (poly) or knots (PWL)
+    uint16_t flags;             // CAL_VALID once committed
+    float r_squared;            // Against the recorded points, 0 if unknown
+    float z_min;                // Z span sampled into the LUT
+    float z_max;
+    float temp_coeff;           // Z drift in mT/degC, removed before the model is applied
+    float temp_ref_c;           // Temperature with no correction
+    float coeffs[2 * CAL_MAX_POINTS];
+} cal_model_t;
+
+typedef enum {
+    MLX_OK = 0,
+    MLX_ERR_I2C,        // NACK or bus error
+    MLX_ERR_TIMEOUT,    // I2C transfer or conversion took too long
+    MLX_ERR_STATUS      // Sensor flagged an error in its status byte
+} mlx_result_t;
+
+typedef enum {
+    ACQ_MODE_SINGLE = 0,    // SM + wait + RM, paced by a hardware timer every acq_period_us
+    ACQ_MODE_BURST = 1,     // Sensor free-runs, DRDY interrupt reads each sample
+    ACQ_MODE_WOC = 2        // Sensor converts on its own and raises DRDY only when Z changes
+} acq_mode_t;
+
+typedef enum {
+    TRIGGER_OFF = 0,
+    TRIGGER_FORCE,          // Force rises through the level (N)
+    TRIGGER_DZDT            // |dZ/dt| reaches the level (mT/s)
+} trigger_mode_t;
+
+// Raw measurement as returned by RM (resolution offset already removed)
+typedef struct {
+    uint64_t time_us;       // time_us_64() at SM (single) or the DRDY edge (burst)
+    uint16_t seq;           // Per-sensor acquisition sequence number (set by core1)
+    uint16_t t;             // Raw temperature, 0 unless T is measured
+    int16_t x;              // X/Y are 0 unless measured
+    int16_t y;
+    int16_t z;
+    uint8_t status;
+    uint8_t sensor;         // Index into mlx_devices
+    uint8_t range;          // MLX_RANGE() the sample was taken with
+} mlx_sample_t;
+
+typedef enum {
+    MLX_ACQ_IDLE = 0,
+    MLX_ACQ_CONVERTING,     // SM sent, waiting for read_at
+    MLX_ACQ_READING         // RM queued on the bus
+} mlx_acq_state_t;
+
+typedef enum {
+    BIQUAD_OFF = 0,
+    BIQUAD_LOWPASS,
+    BIQUAD_NOTCH
+} biquad_type_t;
+
+// Filter chain settings: median -> biquad -> moving average -> EMA.
+// A stage is off when its length/type/weight is 0.
+typedef struct {
+    uint8_t median_len;         // Odd, up to FILTER_MEDIAN_MAX
+    biquad_type_t biquad;
+    float biquad_hz;            // Cut-off or notch frequency
+    float biquad_q;
+    uint8_t mean_len;           // Up to FILTER_MEAN_MAX
+    float ema;                  // Weight of the previous output, see smooth()
+} filter_config_t;
+
+// RBJ biquad, direct form I, coefficients normalised by a0
+typedef struct {
+    coeff_t b0, b1, b2, a1, a2;
+    value_t x1, x2, y1, y2;
+} biquad_t;
+
+// Filter chain state, no allocation: every window is sized for its maximum
+typedef struct {
+    value_t median_buf[FILTER_MEDIAN_MAX];
+    uint8_t median_pos;
+    biquad_t bq;
+    float bq_rate_hz;           // Sample rate the biquad was designed for
+    value_t mean_buf[FILTER_MEAN_MAX];
+    uint8_t mean_pos;
+    value_acc_t mean_sum;
+    value_t ema_weight;         // filter_config_t.ema as value_t
+    value_t out;                // Last chain output
+} filter_state_t;
+
+/**
+ * Intervals between consecutive sample timestamps of one sensor. Bin k of
+ * the histogram counts intervals of nominal + (k - JITTER_BINS/2) * JITTER_BIN_US
+ * up to one bin width more; the end bins also take everything beyond.
+ */
+typedef struct {
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t hist[JITTER_BINS];
+    uint64_t last_us;           // Previous sample time, 0 before the first
+} jitter_stats_t;
+
+// Hot-path counters of one sensor for the "stats" command, written by core1
+typedef struct {
+    uint32_t samples;           // Queued for core0
+    uint32_t i2c_nack;          // MLX_ERR_I2C
+    uint32_t i2c_timeout;       // MLX_ERR_TIMEOUT: SCL held or a transfer that never finished
+    uint32_t conv_timeout;      // No valid data within MLX_CONV_TIMEOUT_US of the expected end
+    uint32_t status_err;        // MLX_ERR_STATUS from SM or RM
+    uint32_t flag_error;        // Status bits seen in the failing status bytes
+    uint32_t flag_sed;
+    uint32_t flag_rs;
+    uint32_t recoveries;        // Reinitialised by the supervisor
+    uint32_t recovery_fails;    // Reinit attempts that failed
+    uint32_t recovery_last_ms;  // First failed measurement to back up, of the last recovery
+    uint32_t recovery_max_ms;
+    uint32_t bus_resets;        // Bus recoveries run for this sensor
+} mlx_stats_t;
+
+// Loop and output counters for the "stats" command
+typedef struct {
+    uint32_t core1_max_us;      // Longest single cycle or burst poll (written by core1)
+    uint32_t core0_max_us;      // Longest processing + output of one sample (written by core0)
+    uint32_t usb_dropped;       // Samples not written because no host had the port open
+} loop_stats_t;
+
+// Per-sensor configuration and state
+typedef struct {
+    // Configuration
+    const char *label;          // Output label, e.g. "M1"
+    i2c_inst_t *i2c;
+    uint8_t addr;
+    int8_t drdy_pin;            // MLX_NO_DRDY if INT is not wired
+    mlx_config_t cfg;           // Written to the sensor by mlx_init(), then kept in sync
+    bool auto_range;            // Let core1 step the gain to follow the signal
+    uint8_t temp_every;         // Add T to every Nth single measurement, 0 = only if cfg.axes has it
+    cal_model_t cal;            // Replaced by the flash record if one is committed
+    
+    // Set up by mlx_init(), cleared by the supervisor while the sensor is down
+    volatile bool initialized;
+    uint8_t bus;                // Index into mlx_buses
+    
+    // Force LUT, uniformly spaced in Z, see cal_build_lut()
+    value_t cal_lut[CAL_LUT_SIZE];
+    value_t cal_lut_z0;             // Z of cal_lut[0]
+    value_t cal_lut_scale;          // LUT steps per mT
+    
+    // Core1 acquisition state
+    mlx_acq_state_t acq_state;
+    uint8_t meas_axes;              // Axes of the conversion in flight (cfg.axes, plus T when due)
+    uint8_t temp_count;             // Single measurements since the last T
+    absolute_time_t read_at;
+    absolute_time_t timeout_at;
+    uint16_t seq;
+    volatile uint32_t errors;       // Failed measurements
+    mlx_stats_t stats;
+    uint8_t last_status;            // Status byte returned by the last SM
+    int32_t range_down_above;       // Auto-range limits in |Z| counts, see mlx_update_range_limits()
+    int32_t range_up_below;
+    uint16_t range_hold;            // Consecutive samples below range_up_below
+    int8_t range_step;              // Gain step to apply after this cycle
+    volatile uint64_t measured_us;  // Start of the conversion being read (SM or DRDY time)
+    volatile bool drdy_seen;        // A DRDY edge has arrived since boot, so INT is wired
+    bool woc_probe;                 // The read in flight is an RM check, not a wake-up
+    bool woc_ref_set;
+    uint8_t woc_probe_ticks;
+    int16_t woc_ref;                // Z of the first RM check after entering WOC
+    uint16_t woc_threshold;         // WOZ_THRESHOLD in Z counts
+    jitter_stats_t jitter;
+    volatile bool jitter_reset;     // Set by core0, core1 clears the stats
+    uint16_t fail_run;              // Consecutive failed measurements, see supervisor_poll()
+    uint64_t fail_since_us;         // First failure of the run (0 = boot for a sensor that never came up)
+    absolute_time_t retry_at;       // Next reinit attempt while down
+    uint32_t backoff_ms;
+    uint8_t recover_tries;          // Reinit attempts since the sensor went down
+    
+    // Configuration request from core0, applied by core1 between reads
+    mlx_config_t cfg_request;
+    volatile bool cfg_pending;
+    volatile mlx_result_t cfg_result;
+    
+    // Read mailbox, filled from the DMA interrupt
+    volatile bool read_pending;     // Waiting for the bus
+    volatile bool sample_ready;
+    volatile mlx_result_t read_result;
+    volatile uint32_t overruns;     // Samples overwritten before core1 took them
+    mlx_sample_t sample;
+    
+    // Core0 processing state
+    filter_config_t filter;
+    filter_state_t filter_state;
+    bool has_reading;               // Filter primed with a first sample
+    uint64_t rate_t0;               // Start of the current rate measurement
+    uint16_t rate_n;
+    float sample_rate_hz;           // Measured, 0 until the first window is in
+    uint32_t errors_reported;
+    bool up_reported;               // initialized as last reported by core0
+    uint64_t reported_us;           // Last sample streamed while a trigger is armed
+    value_t power_ref;              // Z at the last activity, see power_feed()
+    bool has_temp;                  // temp_c holds a reading
+    float temp_c;                   // Last measured temperature
+    value_t temp_comp_mT;           // cal.temp_coeff * (temp_c - cal.temp_ref_c), subtracted from Z
+    
+    // Zero offset (core0), see cmd_tare()
+    value_t z_offset;               // mT added to every Z reading
+    value_t cal_zero_z;             // Z at which the model gives 0 N, from cal_build_lut()
+    bool tare_track;                // Follow slow baseline drift while unloaded and quiet
+    bool track_primed;
+    value_t track_mean;             // EMA of Z
+    value_t track_dev;              // EMA of |Z - track_mean|
+    value_t track_carry;            // Offset steps too small for one value_t LSB (fixed point)
+    uint16_t tare_remaining;        // Readings still to average for "tare", 0 when idle
+    uint16_t tare_n;
+    value_acc_t tare_sum;
+} mlx_dev_t;
+
+// Per-bus pins and DMA read engine
+typedef struct {
+    i2c_inst_t *i2c;
+    uint sda_pin;
+    uint scl_pin;
+    bool used;
+    int dma_tx_chan;
+    int dma_rx_chan;
+    uint32_t dma_cmds[1 + MLX90393_RESPONSE_MAX];   // RM write + one read request per byte
+    uint8_t dma_rx[MLX90393_RESPONSE_MAX];          // Status + 2 bytes per measured axis
+    volatile int active;        // Device being read, -1 if idle
+    volatile bool hold;         // Held for blocking transfers, see mlx_bus_acquire()
+    int last;                   // Device read last, for round-robin
+} mlx_bus_t;
+
+typedef enum {
+    OUTPUT_FORMAT_TEXT = 0,     // "Z-axis(M1): X.XXX mT" lines
+    OUTPUT_FORMAT_BINARY = 1    // sample_frame_t per raw sample
+} output_format_t;
+
+/**
+ * Binary sample frame, little-endian, 20 bytes. The sync bytes are never
+ * valid ASCII so text lines (banner, errors) can share the stream. CRC is
+ * CRC-16/CCITT-FALSE over everything between the sync bytes and the CRC.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t sync[2];        // FRAME_SYNC0, FRAME_SYNC1
+    uint8_t type;           // FRAME_TYPE_*
+    uint8_t sensor;         // Index into mlx_devices, 0 = M1
+    uint16_t seq;
+    uint32_t time_us;       // Low 32 bits of time_us_64()
+    int16_t x;
+    int16_t y;
+    int16_t z;
+    uint8_t status;         // MLX90393 status byte
+    uint8_t range;          // MLX_RANGE(gain, res), selects the LSB on the host
+    uint16_t crc;
+} sample_frame_t;
+
+// Single-producer/single-consumer sample ring (capacity is a power of two)
+typedef struct {
+    mlx_sample_t *buf;
+    uint32_t mask;              // Capacity - 1
+    volatile uint32_t head;     // Written by the producer only
+    volatile uint32_t tail;     // Written by the consumer only
+    volatile uint32_t dropped;  // Samples lost because the ring was full
+} sample_ring_t;
+
+typedef struct {
+    const char *name;
+    void (*handler)(char *args);
+    const char *help;
+} command_t;
+
+/**
+ * Flash record in the sector at CAL_STORE_OFFSET. CRC is CRC-16/CCITT-FALSE
+ * over everything before it; a mismatch in magic, version, size or CRC
+ * means the compiled-in defaults are used.
+ */
+typedef struct {
+    uint32_t magic;             // CAL_STORE_MAGIC
+    uint16_t version;           // CAL_STORE_VERSION
+    uint16_t size;              // sizeof(cal_store_t)
+    cal_model_t sensors[CAL_STORE_MAX_SENSORS];     // Indexed like mlx_devices
+    float z_offset[CAL_STORE_MAX_SENSORS];          // Tare, see cmd_tare()
+    uint8_t tare_track[CAL_STORE_MAX_SENSORS];
+    uint16_t reserved;
+    uint16_t crc;
+} cal_store_t;
+
+#define CAL_STORE_PROGRAM_SIZE (((sizeof(cal_store_t) + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE) * FLASH_PAGE_SIZE)
+
+// One recorded weight point
+typedef struct {
+    float force_n;
+    float z_mT;
+} cal_point_t;
+
+// Calibration session for one sensor (core0)
+typedef struct {
+    cal_point_t points[CAL_MAX_POINTS];
+    uint8_t count;
+    
+    // Point being collected by "cal add"
+    uint16_t collect_remaining;     // 0 when idle
+    uint16_t collect_n;
+    float collect_force_n;
+    float collect_sum;
+    
+    // Last "cal fit" or "cal poly", written by "cal commit"
+    bool fit_valid;
+    cal_model_t fit;
+    
+    // "cal temp" drift run: sums of (T, Z) relative to the first reading, at a constant load
+    bool temp_collecting;
+    uint32_t temp_n;
+    float temp_t0, temp_z0;
+    double temp_sum_t, temp_sum_z, temp_sum_tt, temp_sum_tz;
+    float temp_min_c, temp_max_c;
+    
+    // Last "cal temp" result, written by "cal commit" with or without a new fit
+    bool temp_valid;
+    float temp_coeff;
+    float temp_ref_c;
+} cal_session_t;
+
+/**
+ * Event capture on one sensor. While armed the pre-trigger ring holds the
+ * last `pre` samples; a trigger freezes it and `post` more samples (the
+ * trigger sample first) complete the window, which is sent as one block.
+ */
+typedef struct {
+    trigger_mode_t mode;
+    uint8_t sensor;
+    value_t level;              // N or mT/s, see trigger_mode_t
+    uint16_t pre;
+    uint16_t post;
+    uint32_t idle_us;           // Stream interval between events
+    uint32_t saved_period_us;   // Single mode period before arming
+    
+    bool rearmed;               // Back below the level since the last event
+    bool capturing;
+    uint16_t pre_pos;           // Next slot of the pre-trigger ring
+    uint16_t pre_count;
+    uint16_t post_count;
+    uint32_t events;
+    value_t z_prev;             // For dZ/dt
+    uint64_t t_prev;
+} trigger_t;
+
+/**
+ * Adaptive power (core0 policy, core1 wake). Once no sensor has moved by
+ * POWER_IDLE_BAND_MT for idle_ms, core0 asks for ACQ_MODE_WOC and both
+ * cores sleep between interrupts. The first change wakes core1, which
+ * publishes that sample and restores active_mode/active_period_us at once.
+ */
+typedef struct {
+    bool adaptive;
+    uint32_t idle_ms;
+    float wake_mT;
+    bool idle;                  // WOC (or its single mode fallback) requested
+    acq_mode_t active_mode;     // What to go back to
+    uint32_t active_period_us;
+    uint64_t active_us;         // Last sample that moved
+} power_t;
+
+/**
+ * A command waiting on core1. command_poll() runs finish() once busy() is
+ * false, or with done = false at the deadline, and reads no further input
+ * until then, so samples and USB keep flowing while core1 catches up.
+ */
+typedef struct {
+    bool active;
+    bool (*busy)(void);
+    void (*finish)(bool done);
+    absolute_time_t deadline;
+    
+    // What finish() needs from the command
+    size_t sensor;
+    int auto_range;
+    int temp_every;
+    acq_mode_t mode;
+    trigger_t trigger;
+    uint32_t iterations;
+    bool sensor_stages;
+} command_wait_t;
+
+// Stages timed by the "bench" command. The sensor stages run on core1.
+typedef enum {
+    BENCH_I2C_SM = 0,           // SM command transaction
+    BENCH_CONV_WAIT,            // SM done until RM returns valid data (polling)
+    BENCH_I2C_RM,               // The successful blocking RM transaction
+    BENCH_DMA_RM,               // DMA RM from request to mailbox
+    BENCH_CORE1_STAGES,
+    BENCH_CONVERT = BENCH_CORE1_STAGES,     // mlx_z_to_mT()
+    BENCH_SMOOTH,               // smooth()
+    BENCH_FILTER,               // filter_step() with the sensor's chain
+    BENCH_FORCE,                // calculate_force()
+    BENCH_FORMAT,               // Formatting the text output line
+    BENCH_USB,                  // printf + fflush of a line of that length
+    BENCH_STAGES
+} bench_stage_t;
+
 // LSB lookup table [HALLCONF=0][GAIN][RES][XY/Z]
 const float mlx90393_lsb_lookup[2][8][4][2] = {
     /* HALLCONF = 0xC (default) */
@@ -79,193 +731,3719 @@ const float mlx90393_lsb_lookup[2][8][4][2] = {
     }
 };
 
-// Current sensor settings
-mlx90393_gain_t mlx_gain = MLX90393_GAIN_1X;
-mlx90393_resolution_t mlx_res_z = MLX90393_RES_16;
+// ========================================
+// SENSOR TABLE
+// ========================================
+// One entry per MLX90393. Up to four sensors fit on a bus (A0/A1 select
+// 0x0C-0x0F). Sensors on i2c0 and i2c1 are read in parallel. Example for
+// a second pad on the other bus:
+//   {.label = "M2", .i2c = I2C1_PORT, .addr = 0x0C, .drdy_pin = 7, ...},
+// A fixed config build replaces gain and resolution with FIXED_GAIN/FIXED_RES.
+// Without FORCE_SENSOR_RUNTIME_CAL its offset, calibration and EMA are constants too.
+mlx_dev_t mlx_devices[] = {
+    {
+        .label = "M1",
+        .i2c = I2C_PORT,
+        .addr = MLX90393_ADDR,
+        .drdy_pin = MLX_DRDY_PIN,
+        .cfg = {
+            .axes = MLX90393_AXIS_ALL,      // MLX90393_AXIS_Z for Z-only (~3x faster)
+            .gain = MLX90393_GAIN_1X,
+            .res = MLX90393_RES_16,
+            .osr = MLX90393_OSR_0,
+            .osr2 = MLX90393_OSR_0,
+            .dig_filt = MLX90393_FILTER_0,
+        },
+        .auto_range = false,
+        .temp_every = TEMP_EVERY_DEFAULT,
+        .z_offset = VALUE_FROM_FLOAT(Z_OFFSET_MT),
+        .filter = {
+            .biquad_q = FILTER_Q_DEFAULT,
+            .ema = FILTER_VAL,
+        },
+        .cal = {
+            .type = CAL_MODEL_POLY,
+            .count = 2,
+            .z_min = 0.0f,
+            .z_max = CAL_DEFAULT_SPAN_MT,
+            .coeffs = {CALIBRATION_INTERCEPT, CALIBRATION_SLOPE},
+        },
+    },
+};
+#define MLX_SENSOR_COUNT count_of(mlx_devices)
+_Static_assert(count_of(mlx_devices) <= CAL_STORE_MAX_SENSORS, "raise CAL_STORE_MAX_SENSORS");
+
+mlx_bus_t mlx_buses[] = {
+    {.i2c = I2C_PORT, .sda_pin = I2C_SDA_PIN, .scl_pin = I2C_SCL_PIN, .dma_tx_chan = -1, .dma_rx_chan = -1, .active = -1},
+    {.i2c = I2C1_PORT, .sda_pin = I2C1_SDA_PIN, .scl_pin = I2C1_SCL_PIN, .dma_tx_chan = -1, .dma_rx_chan = -1, .active = -1},
+};
+#define MLX_BUS_COUNT count_of(mlx_buses)
 
 // ========================================
 // GLOBAL VARIABLES
 // ========================================
-float smoothed_z = 0.0f;
-bool first_mag_reading = true;
-bool mlx_initialized = false;
+acq_mode_t acq_mode = ACQ_MODE_DEFAULT;
+uint32_t acq_period_us = SAMPLE_PERIOD_US;
+
+// Single mode pacing, set from core1's timer interrupt
+volatile bool acq_tick = false;
+volatile bool supervisor_tick = false;      // Set every SUPERVISOR_PERIOD_MS from core1's timer
+volatile uint32_t acq_ticks_missed = 0;     // Ticks that found the previous cycle still running
+
+// Mode/rate change request from core0, applied by core1 (see acq_apply_timing)
+acq_mode_t acq_mode_request;
+uint32_t acq_period_request;
+volatile bool acq_timing_pending = false;
+
+loop_stats_t loop_stats = {0};
+volatile bool stats_reset = false;          // Set by core0, core1 clears its counters
+
+// Acquisition -> processing queue (core1 writes)
+mlx_sample_t acq_ring_buf[SAMPLE_RING_SIZE];
+sample_ring_t acq_ring = {.buf = acq_ring_buf, .mask = SAMPLE_RING_SIZE - 1};
+
+output_format_t output_format = OUTPUT_FORMAT_DEFAULT;
+bool output_streaming = true;           // "stream stop" keeps processing but sends nothing
+
+// USB output batch, see output_append()
+char out_buf[OUTPUT_BUF_SIZE];
+size_t out_len = 0;
+uint32_t out_count = 0;                 // Samples in out_buf
+uint32_t out_first_us = 0;              // When the oldest of them was added
+uint32_t out_batch_samples = OUTPUT_BATCH_SAMPLES;
+uint32_t out_batch_us = OUTPUT_BATCH_US;
+
+// Raw sample history on core0, drained by the "dump" command
+mlx_sample_t history_buf[HISTORY_SIZE];
+sample_ring_t history = {.buf = history_buf, .mask = HISTORY_SIZE - 1};
+
+// mT per Z LSB for every range byte, see mlx_init_scales()
+#if USE_FIXED_POINT
+uint32_t mlx_z_scale_q32[MLX_RANGE_COUNT];     // Q0.32
+#else
+float mlx_z_scale[MLX_RANGE_COUNT];
+#endif
+#if FIXED_SENSOR_CONFIG
+// The one range of a fixed config build, a constant load the compiler folds
+#define FIXED_Z_LSB_MT (mlx90393_lsb_lookup[0][FIXED_GAIN][FIXED_RES][1] / 1000.0f)
+#endif
+
+power_t power = {
+    .idle_ms = POWER_IDLE_MS,
+    .wake_mT = POWER_WAKE_MT,
+};
+volatile bool power_woke = false;          // Set by core1 when a WOC wake restored the active mode
+
+// Trigger capture window: pre-trigger ring in [0, pre), post samples after it
+trigger_t trigger = {
+    .mode = TRIGGER_OFF,
+    .pre = TRIGGER_PRE_DEFAULT,
+    .post = TRIGGER_POST_DEFAULT,
+    .idle_us = (uint32_t)(1e6f / TRIGGER_IDLE_HZ),
+};
+mlx_sample_t trigger_buf[TRIGGER_WINDOW_MAX];
+
+// Benchmark: cycle counts per stage, request handed to core1 for the sensor stages
+uint32_t bench_cycles[BENCH_STAGES][BENCH_MAX_ITER];
+volatile uint32_t bench_request = 0;        // Iterations, core1 clears it when done
+volatile uint32_t bench_sensor = 0;
+volatile bool bench_ok = false;
+
+// Calibration: RAM copy of the flash record and per-sensor sessions (core0)
+cal_store_t cal_store;
+bool cal_store_loaded = false;          // cal_store came from flash
+bool cal_store_dirty = false;           // A tare is waiting for cal_store_poll() to save it
+uint64_t cal_store_saved_us = 0;
+cal_session_t cal_sessions[count_of(mlx_devices)];
+
+char cmd_line[CMD_LINE_MAX];
+uint32_t cmd_len = 0;
+command_wait_t cmd_wait;
 
 // ========================================
 // MLX90393 FUNCTIONS
 // ========================================
 
-bool mlx_transceive(uint8_t *tx_data, uint8_t tx_len, uint8_t *rx_data, uint8_t rx_len) {
-    int ret = i2c_write_blocking(I2C_PORT, MLX90393_ADDR, tx_data, tx_len, false);
-    if (ret < 0) return false;
-    
-    sleep_ms(10);
-    
-    if (rx_len > 0) {
-        ret = i2c_read_blocking(I2C_PORT, MLX90393_ADDR, rx_data, rx_len + 1, false);  // +1 for status
-        return ret > 0;
-    }
+mlx_result_t mlx_transceive(mlx_dev_t *dev, const uint8_t *tx_data, uint8_t tx_len, uint8_t *rx_data, uint8_t rx_len) {
+    int ret = i2c_write_timeout_us(dev->i2c, dev->addr, tx_data, tx_len, false, I2C_TIMEOUT_US);
+    if (ret < 0) return (ret == PICO_ERROR_TIMEOUT) ? MLX_ERR_TIMEOUT : MLX_ERR_I2C;
     
+    // The sensor answers straight away with its status byte (plus data for RM)
     uint8_t status;
-    ret = i2c_read_blocking(I2C_PORT, MLX90393_ADDR, &status, 1, false);
-    if (ret > 0 && rx_data) {
+    uint8_t *buf = (rx_len > 0) ? rx_data : &status;
+    ret = i2c_read_timeout_us(dev->i2c, dev->addr, buf, rx_len + 1, false, I2C_TIMEOUT_US);  // +1 for status
+    if (ret < 0) return (ret == PICO_ERROR_TIMEOUT) ? MLX_ERR_TIMEOUT : MLX_ERR_I2C;
+    
+    if (rx_len == 0 && rx_data) {
         rx_data[0] = status;
     }
-    return ret > 0;
+    return MLX_OK;
 }
 
-bool mlx_exit_mode() {
+bool mlx_exit_mode(mlx_dev_t *dev) {
     uint8_t cmd = MLX90393_REG_EX;
     uint8_t status;
-    if (!mlx_transceive(&cmd, 1, &status, 0)) return false;
+    if (mlx_transceive(dev, &cmd, 1, &status, 0) != MLX_OK) return false;
     return (status >> 2) == 0x00;
 }
 
-bool mlx_reset() {
+bool mlx_reset(mlx_dev_t *dev) {
     uint8_t cmd = MLX90393_REG_RT;
     uint8_t status;
-    if (!mlx_transceive(&cmd, 1, &status, 0)) return false;
+    if (mlx_transceive(dev, &cmd, 1, &status, 0) != MLX_OK) return false;
     sleep_ms(5);
     return (status >> 2) == 0x01;
 }
 
-bool mlx_start_measurement() {
-    uint8_t cmd = MLX90393_REG_SM | MLX90393_AXIS_ALL;
+/**
+ * Expected duration of a single measurement of the given axes.
+ * Per the datasheet each magnetic axis takes 67 + 64 * 2^OSR * (2 + 2^DIG_FILT) us
+ * and temperature takes 67 + 192 * 2^OSR2 us. Gain and resolution only change
+ * the LSB size, not the conversion time.
+ */
+uint32_t mlx_conversion_time_us(const mlx_dev_t *dev, uint8_t axes) {
+    uint32_t t_axis = 67 + 64 * (1u << dev->cfg.osr) * (2 + (1u << dev->cfg.dig_filt));
+    uint32_t t_temp = 67 + 192 * (1u << dev->cfg.osr2);
+    
+    uint32_t t = MLX_CONV_OVERHEAD_US;
+    if (axes & MLX90393_AXIS_X) t += t_axis;
+    if (axes & MLX90393_AXIS_Y) t += t_axis;
+    if (axes & MLX90393_AXIS_Z) t += t_axis;
+    if (axes & MLX90393_AXIS_T) t += t_temp;
+    return t;
+}
+
+/**
+ * Bytes in an RM response for an axis mask: status + 2 per axis.
+ */
+uint8_t mlx_response_len(uint8_t axes) {
+    uint8_t len = 1;
+    for (uint8_t bit = MLX90393_AXIS_T; bit <= MLX90393_AXIS_Z; bit <<= 1) {
+        if (axes & bit) len += 2;
+    }
+    return len;
+}
+
+mlx_result_t mlx_start_measurement(mlx_dev_t *dev) {
+    uint8_t cmd = MLX90393_REG_SM | dev->meas_axes;
     uint8_t status;
-    if (!mlx_transceive(&cmd, 1, &status, 0)) return false;
+    mlx_result_t res = mlx_transceive(dev, &cmd, 1, &status, 0);
+    if (res != MLX_OK) return res;
+    dev->last_status = status;
     uint8_t stat = status >> 2;
-    return (stat == 0x00 || stat == 0x08);
+    return (stat == 0x00 || stat == 0x08) ? MLX_OK : MLX_ERR_STATUS;
+}
+
+/**
+ * Parse an RM response into raw signed counts. The sensor only sends the
+ * axes in the mask (dev->meas_axes, as started), in T, X, Y, Z order.
+ */
+mlx_result_t mlx_parse_sample(const mlx_dev_t *dev, const uint8_t *data, mlx_sample_t *sample) {
+    // Mode bits may be set (burst), but ERROR/SED/RS must be clear
+    sample->status = data[0];
+    if (((data[0] & ~MLX90393_STATUS_MODE_MASK) >> 2) != 0x00) return MLX_ERR_STATUS;
+    
+    sample->time_us = time_us_64();
+#if FIXED_SENSOR_CONFIG
+    sample->range = MLX_RANGE(FIXED_GAIN, FIXED_RES);
+    const uint16_t offset = (FIXED_RES == MLX90393_RES_18) ? 0x8000 : (FIXED_RES == MLX90393_RES_19) ? 0x4000 : 0;
+#else
+    sample->range = MLX_RANGE(dev->cfg.gain, dev->cfg.res);
+    
+    // Adjust for 18/19 bit resolution (unsigned with a mid-scale offset)
+    uint16_t offset = 0;
+    if (dev->cfg.res == MLX90393_RES_18) offset = 0x8000;
+    if (dev->cfg.res == MLX90393_RES_19) offset = 0x4000;
+#endif
+    
+    // Parse raw values (big-endian 16-bit)
+    uint8_t axes = dev->meas_axes;
+    const uint8_t *p = &data[1];
+    sample->t = 0;
+    sample->x = sample->y = sample->z = 0;
+    if (axes & MLX90393_AXIS_T) { sample->t = (uint16_t)((p[0] << 8) | p[1]); p += 2; }
+    if (axes & MLX90393_AXIS_X) { sample->x = (int16_t)(((p[0] << 8) | p[1]) - offset); p += 2; }
+    if (axes & MLX90393_AXIS_Y) { sample->y = (int16_t)(((p[0] << 8) | p[1]) - offset); p += 2; }
+    if (axes & MLX90393_AXIS_Z) { sample->z = (int16_t)(((p[0] << 8) | p[1]) - offset); }
+    
+    return MLX_OK;
 }
 
-bool mlx_read_measurement(float *z) {
-    uint8_t cmd = MLX90393_REG_RM | MLX90393_AXIS_ALL;
-    uint8_t data[7];  // 1 status + 6 data bytes
+/**
+ * Blocking RM. The acquisition loop uses the DMA path below instead.
+ */
+mlx_result_t mlx_read_sample(mlx_dev_t *dev, mlx_sample_t *sample) {
+    uint8_t cmd = MLX90393_REG_RM | dev->meas_axes;
+    uint8_t data[MLX90393_RESPONSE_MAX];
     
-    if (!mlx_transceive(&cmd, 1, data, 6)) return false;
+    mlx_result_t res = mlx_transceive(dev, &cmd, 1, data, mlx_response_len(dev->meas_axes) - 1);
+    if (res != MLX_OK) return res;
+    return mlx_parse_sample(dev, data, sample);
+}
+
+/**
+ * Blocking single measurement transaction: start, wait for the expected
+ * conversion time, then poll RM until the sensor returns valid data.
+ * Returns MLX_ERR_TIMEOUT if no valid data arrives within
+ * MLX_CONV_TIMEOUT_US of the expected end of conversion.
+ */
+mlx_result_t mlx_read_data(mlx_dev_t *dev, mlx_sample_t *sample) {
+    mlx_result_t res = mlx_start_measurement(dev);
+    if (res != MLX_OK) return res;
     
-    if ((data[0] >> 2) == 0x00) {
-        // Parse Z-axis raw value (big-endian signed 16-bit)
-        int16_t zi = (data[5] << 8) | data[6];
-        
-        // Adjust for 18/19 bit resolution
-        if (mlx_res_z == MLX90393_RES_18) zi -= 0x8000;
-        if (mlx_res_z == MLX90393_RES_19) zi -= 0x4000;
-        
-        // Convert to uT using LSB lookup table (HALLCONF=0xC)
-        float z_uT = (float)zi * mlx90393_lsb_lookup[0][mlx_gain][mlx_res_z][1];
-        
-        // Convert to mT (millitesla) and add offset
-        float z_mT = (z_uT / 1000.0f) + Z_OFFSET_MT;
-        
-        // Ensure non-negative
-        *z = (z_mT < 0.0f) ? 0.0f : z_mT;
-        
-        return true;
+    absolute_time_t start = get_absolute_time();
+    uint32_t conv_us = mlx_conversion_time_us(dev, dev->meas_axes);
+    absolute_time_t deadline = delayed_by_us(start, conv_us + MLX_CONV_TIMEOUT_US);
+    sleep_until(delayed_by_us(start, conv_us));
+    
+    while (true) {
+        res = mlx_read_sample(dev, sample);
+        if (res != MLX_ERR_STATUS) return res;
+        if (time_reached(deadline)) return MLX_ERR_TIMEOUT;
+        sleep_us(MLX_POLL_INTERVAL_US);
     }
-    return false;
 }
 
-bool mlx_read_data(float *z) {
-    if (!mlx_start_measurement()) return false;
-    sleep_ms(10);
-    return mlx_read_measurement(z);
+/**
+ * Read a 16-bit configuration register (RR).
+ */
+mlx_result_t mlx_read_register(mlx_dev_t *dev, uint8_t reg, uint16_t *value) {
+    uint8_t cmd[2] = {MLX90393_REG_RR, (uint8_t)(reg << 2)};
+    uint8_t data[3];  // 1 status + 2 data bytes
+    mlx_result_t res = mlx_transceive(dev, cmd, sizeof(cmd), data, 2);
+    if (res != MLX_OK) return res;
+    if (data[0] & MLX90393_STATUS_ERROR) return MLX_ERR_STATUS;
+    *value = (uint16_t)((data[1] << 8) | data[2]);
+    return MLX_OK;
 }
 
-bool mlx_init() {
-    if (!mlx_exit_mode()) return false;
-    if (!mlx_reset()) return false;
-    sleep_ms(10);
-    mlx_initialized = true;
-    return true;
+/**
+ * Write a 16-bit configuration register (WR). The sensor must be idle.
+ */
+mlx_result_t mlx_write_register(mlx_dev_t *dev, uint8_t reg, uint16_t value) {
+    uint8_t cmd[4] = {MLX90393_REG_WR, (uint8_t)(value >> 8), (uint8_t)value, (uint8_t)(reg << 2)};
+    uint8_t status;
+    mlx_result_t res = mlx_transceive(dev, cmd, sizeof(cmd), &status, 0);
+    if (res != MLX_OK) return res;
+    return (status & MLX90393_STATUS_ERROR) ? MLX_ERR_STATUS : MLX_OK;
+}
+
+/**
+ * Read-modify-write the bits in mask, then read back to make sure the
+ * sensor took the new value.
+ */
+mlx_result_t mlx_update_register(mlx_dev_t *dev, uint8_t reg, uint16_t mask, uint16_t value) {
+    uint16_t old;
+    mlx_result_t res = mlx_read_register(dev, reg, &old);
+    if (res != MLX_OK) return res;
+    
+    uint16_t new_value = (old & ~mask) | (value & mask);
+    if (new_value != old) {
+        res = mlx_write_register(dev, reg, new_value);
+        if (res != MLX_OK) return res;
+    }
+    
+    uint16_t check;
+    res = mlx_read_register(dev, reg, &check);
+    if (res != MLX_OK) return res;
+    return (check == new_value) ? MLX_OK : MLX_ERR_STATUS;
 }
 
-float smooth(float data, float filter_val, float smoothed_val) {
-    return (data * (1.0f - filter_val)) + (smoothed_val * filter_val);
+/**
+ * Work out the auto-range thresholds for the current gain. Stepping down
+ * happens above AUTORANGE_HIGH_PCT of full scale; stepping up only when the
+ * reading, scaled to the next higher gain, would stay under
+ * AUTORANGE_LOW_PCT, so a single step can never trigger the opposite one.
+ */
+void mlx_update_range_limits(mlx_dev_t *dev) {
+    // RES_19 only spans +-2^14 counts once the offset is removed
+    int32_t full_scale = (dev->cfg.res == MLX90393_RES_19) ? 16384 : 32768;
+    dev->range_down_above = full_scale * AUTORANGE_HIGH_PCT / 100;
+    dev->range_up_below = 0;
+    dev->range_hold = 0;
+    if (dev->cfg.gain < MLX90393_GAIN_1X) {
+        float lsb = mlx90393_lsb_lookup[0][dev->cfg.gain][dev->cfg.res][1];
+        float lsb_up = mlx90393_lsb_lookup[0][dev->cfg.gain + 1][dev->cfg.res][1];
+        dev->range_up_below = (int32_t)(full_scale * AUTORANGE_LOW_PCT / 100 * lsb_up / lsb);
+    }
 }
 
 /**
- * Calculate force from Z-axis reading using calibration constants
- * Formula: Force (N) = slope * Z-axis (mT) + intercept
+ * Write gain, resolution, oversampling and digital filter to the sensor.
+ * HALLCONF is forced to 0xC so mlx90393_lsb_lookup[0] applies. dev->cfg
+ * only follows the registers that were actually written.
  */
-float calculate_force(float z_axis_mT) {
-    float force = (CALIBRATION_SLOPE * z_axis_mT) + CALIBRATION_INTERCEPT;
-    // Clamp to non-negative values
-    return (force < 0.0f) ? 0.0f : force;
+mlx_result_t mlx_configure(mlx_dev_t *dev, const mlx_config_t *cfg) {
+    uint16_t conf1 = MLX90393_HALLCONF_DEFAULT | ((uint16_t)cfg->gain << MLX90393_GAIN_SHIFT);
+    mlx_result_t res = mlx_update_register(dev, MLX90393_CONF1, MLX90393_GAIN_MASK | MLX90393_HALLCONF_MASK, conf1);
+    if (res != MLX_OK) return res;
+    dev->cfg.gain = cfg->gain;
+    
+    uint16_t conf3 = ((uint16_t)cfg->osr << MLX90393_OSR_SHIFT) |
+                     ((uint16_t)cfg->dig_filt << MLX90393_DIG_FILT_SHIFT) |
+                     ((uint16_t)cfg->res << MLX90393_RES_X_SHIFT) |
+                     ((uint16_t)cfg->res << MLX90393_RES_Y_SHIFT) |
+                     ((uint16_t)cfg->res << MLX90393_RES_Z_SHIFT) |
+                     ((uint16_t)cfg->osr2 << MLX90393_OSR2_SHIFT);
+    res = mlx_update_register(dev, MLX90393_CONF3, MLX90393_CONF3_MASK, conf3);
+    if (res == MLX_OK) dev->cfg = *cfg;
+    dev->meas_axes = dev->cfg.axes;
+    
+    mlx_update_range_limits(dev);
+    return res;
+}
+
+/**
+ * Precompute mT per Z LSB for every gain/resolution from the lookup table
+ * (HALLCONF=0xC), so conversion is a table lookup and one multiply whatever
+ * range the sample was taken with.
+ */
+void mlx_init_scales() {
+    for (int gain = 0; gain < 8; gain++) {
+        for (int res = 0; res < 4; res++) {
+            float lsb_mT = mlx90393_lsb_lookup[0][gain][res][1] / 1000.0f;
+#if USE_FIXED_POINT
+            mlx_z_scale_q32[MLX_RANGE(gain, res)] = (uint32_t)(lsb_mT * 4294967296.0f + 0.5f);
+#else
+            mlx_z_scale[MLX_RANGE(gain, res)] = lsb_mT;
+#endif
+        }
+    }
+}
+
+/**
+ * Convert a sample's raw Z count to mT using the range it was taken with,
+ * plus the sensor's zero offset. Not clamped, so a baseline below the
+ * offset stays visible instead of reading as 0. Fixed config builds use
+ * their constant scale, and their constant offset unless tare is kept.
+ */
+value_t mlx_z_to_mT(const mlx_dev_t *dev, const mlx_sample_t *sample) {
+#if FIXED_PROCESSING && USE_FIXED_POINT
+    (void)dev;
+    return (value_t)(((int64_t)sample->z * (int64_t)(FIXED_Z_LSB_MT * 4294967296.0f + 0.5f)) >> 16) +
+           VALUE_FROM_FLOAT(FIXED_Z_OFFSET_MT);
+#elif FIXED_PROCESSING
+    (void)dev;
+    return (float)sample->z * FIXED_Z_LSB_MT + FIXED_Z_OFFSET_MT;
+#elif FIXED_SENSOR_CONFIG && USE_FIXED_POINT
+    return (value_t)(((int64_t)sample->z * (int64_t)(FIXED_Z_LSB_MT * 4294967296.0f + 0.5f)) >> 16) + dev->z_offset;
+#elif FIXED_SENSOR_CONFIG
+    return (float)sample->z * FIXED_Z_LSB_MT + dev->z_offset;
+#elif USE_FIXED_POINT
+    // Q0.32 scale * count >> 16 lands in Q16.16
+    return (value_t)(((int64_t)sample->z * mlx_z_scale_q32[sample->range]) >> 16) + dev->z_offset;
+#else
+    return (float)sample->z * mlx_z_scale[sample->range] + dev->z_offset;
+#endif
+}
+
+/**
+ * Convert a raw T reading to degC
+ */
+float mlx_temp_c(uint16_t raw) {
+    return MLX90393_TEMP_REF_C + ((int32_t)raw - MLX90393_TEMP_RAW_REF) / MLX90393_TEMP_LSB_PER_C;
+}
+
+bool mlx_init(mlx_dev_t *dev) {
+    if (!mlx_exit_mode(dev)) return false;
+    if (!mlx_reset(dev)) return false;
+    sleep_ms(10);
+    if (mlx_configure(dev, &dev->cfg) != MLX_OK) return false;
+    dev->initialized = true;
+    return true;
 }
 
+#if !FORCE_SENSOR_HOST  // DMA, DRDY interrupts and core1 are hardware only
 // ========================================
-// MAIN
+// DMA MEASUREMENT READS
 // ========================================
-int main() {
-    // Initialize stdio
-    stdio_init_all();
+// Each bus has its own read engine: RM is queued to the I2C controller as
+// DATA_CMD words by one DMA channel while a second channel drains the RX
+// FIFO, so the CPU only sees the completion interrupt. Reads requested
+// while the bus is busy wait in the device's read_pending flag and are
+// started from the completion of the previous one. Both buses run at once.
+
+mlx_bus_t *mlx_bus_of(const mlx_dev_t *dev) {
+    return &mlx_buses[dev->bus];
+}
+
+void mlx_bus_start(mlx_bus_t *bus, int dev_index) {
+    mlx_dev_t *dev = &mlx_devices[dev_index];
+    dev->read_pending = false;
+    bus->active = dev_index;
     
-    // Setup LED
-    gpio_init(LED_PIN);
-    gpio_set_dir(LED_PIN, GPIO_OUT);
+    i2c_hw_t *hw = i2c_get_hw(bus->i2c);
+    hw->enable = 0;
+    hw->tar = dev->addr;
+    hw->enable = 1;
+    (void)hw->clr_tx_abrt;
     
-    // Setup GPIO3 as VCC (optional - comment out if not needed)
-    gpio_init(GPIO3_VCC);
-    gpio_set_dir(GPIO3_VCC, GPIO_OUT);
-    gpio_put(GPIO3_VCC, 1);
+    // Write RM then STOP, then read the response with STOP on the last byte
+    uint8_t len = mlx_response_len(dev->meas_axes);
+    bus->dma_cmds[0] = (MLX90393_REG_RM | dev->meas_axes) | I2C_IC_DATA_CMD_STOP_BITS;
+    for (int i = 1; i <= len; i++) {
+        bus->dma_cmds[i] = I2C_IC_DATA_CMD_CMD_BITS;
+    }
+    bus->dma_cmds[len] |= I2C_IC_DATA_CMD_STOP_BITS;
     
-    // Initialize I2C for MLX90393
-    i2c_init(I2C_PORT, I2C_FREQ);
-    gpio_set_function(I2C_SDA_PIN, GPIO_FUNC_I2C);
-    gpio_set_function(I2C_SCL_PIN, GPIO_FUNC_I2C);
-    gpio_pull_up(I2C_SDA_PIN);
-    gpio_pull_up(I2C_SCL_PIN);
+    dma_channel_config rx_cfg = dma_channel_get_default_config(bus->dma_rx_chan);
+    channel_config_set_transfer_data_size(&rx_cfg, DMA_SIZE_8);
+    channel_config_set_read_increment(&rx_cfg, false);
+    channel_config_set_write_increment(&rx_cfg, true);
+    channel_config_set_dreq(&rx_cfg, i2c_get_dreq(bus->i2c, false));
+    dma_channel_configure(bus->dma_rx_chan, &rx_cfg, bus->dma_rx, &hw->data_cmd, len, true);
     
-    printf("\n===========================================\n");
-    printf("  RASPBERRY PI PICO - FORCE SENSOR\n");
-    printf("===========================================\n");
-    printf("Sensor: MLX90393 Magnetometer\n");
-    printf("I2C: SDA=GPIO%d, SCL=GPIO%d\n", I2C_SDA_PIN, I2C_SCL_PIN);
-    printf("Mode: RAW Z-AXIS OUTPUT\n");
-    printf("===========================================\n\n");
+    dma_channel_config tx_cfg = dma_channel_get_default_config(bus->dma_tx_chan);
+    channel_config_set_transfer_data_size(&tx_cfg, DMA_SIZE_32);
+    channel_config_set_read_increment(&tx_cfg, true);
+    channel_config_set_write_increment(&tx_cfg, false);
+    channel_config_set_dreq(&tx_cfg, i2c_get_dreq(bus->i2c, true));
+    dma_channel_configure(bus->dma_tx_chan, &tx_cfg, &hw->data_cmd, bus->dma_cmds, 1 + len, true);
+}
+
+/**
+ * Start the next pending read on an idle bus, round-robin from the device
+ * after the one read last. Call with interrupts disabled. Nothing starts
+ * while the bus is held.
+ */
+void mlx_bus_next(mlx_bus_t *bus) {
+    if (bus->active >= 0 || bus->hold) return;
+    for (size_t n = 1; n <= MLX_SENSOR_COUNT; n++) {
+        int i = (int)((bus->last + n) % MLX_SENSOR_COUNT);
+        if (mlx_devices[i].read_pending && mlx_bus_of(&mlx_devices[i]) == bus) {
+            bus->last = i;
+            mlx_bus_start(bus, i);
+            return;
+        }
+    }
+}
+
+/**
+ * Hand the finished read to its device mailbox and move the bus on.
+ * A sample core1 has not picked up yet is overwritten and counted.
+ */
+void mlx_bus_finish(mlx_bus_t *bus, mlx_result_t res) {
+    mlx_dev_t *dev = &mlx_devices[bus->active];
+    mlx_sample_t sample = {0};
+    if (res == MLX_OK) res = mlx_parse_sample(dev, bus->dma_rx, &sample);
+    sample.time_us = dev->measured_us;
     
-    sleep_ms(2000);
+    if (dev->sample_ready) dev->overruns++;
+    dev->sample = sample;
+    dev->read_result = res;
+    dev->sample_ready = true;
     
-    // Initialize MLX90393
-    if (mlx_init()) {
-        printf("MLX90393 initialized successfully!\n\n");
-    } else {
-        printf("ERROR: MLX90393 initialization failed!\n");
-        printf("Check I2C wiring and sensor power.\n\n");
+    bus->active = -1;
+    mlx_bus_next(bus);
+}
+
+void mlx_dma_irq_handler() {
+    for (size_t b = 0; b < MLX_BUS_COUNT; b++) {
+        mlx_bus_t *bus = &mlx_buses[b];
+        if (bus->dma_rx_chan < 0 || !dma_channel_get_irq0_status(bus->dma_rx_chan)) continue;
+        dma_channel_acknowledge_irq0(bus->dma_rx_chan);
+        if (bus->active >= 0) mlx_bus_finish(bus, MLX_OK);
+    }
+}
+
+/**
+ * Claim DMA channels for every bus in use. Run on the core that should
+ * service the completion interrupt.
+ */
+void mlx_dma_init() {
+    for (size_t b = 0; b < MLX_BUS_COUNT; b++) {
+        mlx_bus_t *bus = &mlx_buses[b];
+        if (!bus->used) continue;
+        bus->dma_tx_chan = dma_claim_unused_channel(true);
+        bus->dma_rx_chan = dma_claim_unused_channel(true);
+        dma_channel_set_irq0_enabled(bus->dma_rx_chan, true);
+    }
+    irq_add_shared_handler(DMA_IRQ_0, mlx_dma_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(DMA_IRQ_0, true);
+}
+
+/**
+ * Queue a non-blocking RM for a device. The result lands in the device
+ * mailbox (see mlx_take_sample). Safe to call from interrupts.
+ */
+void mlx_request_read(mlx_dev_t *dev) {
+    uint32_t irq_state = save_and_disable_interrupts();
+    dev->read_pending = true;
+    mlx_bus_next(mlx_bus_of(dev));
+    restore_interrupts(irq_state);
+}
+
+/**
+ * Abort the transfer in flight on a bus and fail it with res.
+ */
+void mlx_bus_abort(mlx_bus_t *bus, mlx_result_t res) {
+    uint32_t irq_state = save_and_disable_interrupts();
+    if (bus->active >= 0) {
+        dma_channel_abort(bus->dma_tx_chan);
+        dma_channel_abort(bus->dma_rx_chan);
+        dma_channel_acknowledge_irq0(bus->dma_rx_chan);
+        (void)i2c_get_hw(bus->i2c)->clr_tx_abrt;
+        mlx_bus_finish(bus, res);
+    }
+    restore_interrupts(irq_state);
+}
+
+/**
+ * A NACK aborts the I2C transfer and the RX channel never completes, so
+ * poll for TX_ABRT and fail the read here.
+ */
+void mlx_bus_check_abort(mlx_bus_t *bus) {
+    if (bus->active < 0) return;
+    if (!(i2c_get_hw(bus->i2c)->raw_intr_stat & I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS)) return;
+    mlx_bus_abort(bus, MLX_ERR_I2C);
+}
+
+/**
+ * Take a bus away from the DMA engine for blocking transfers (register
+ * access, mode changes). No new reads start and the one in flight is
+ * allowed to finish first. Core1 only. Returns false if that read hung
+ * and had to be aborted, the bus may then need mlx_bus_recover().
+ */
+bool mlx_bus_acquire(mlx_bus_t *bus) {
+    bus->hold = true;
+    absolute_time_t deadline = make_timeout_time_us(I2C_TIMEOUT_US);
+    while (bus->active >= 0) {
+        mlx_bus_check_abort(bus);
+        if (time_reached(deadline)) {
+            mlx_bus_abort(bus, MLX_ERR_TIMEOUT);
+            return false;
+        }
     }
+    return true;
+}
+
+/**
+ * Hand a held bus back and start any reads that queued up meanwhile.
+ */
+void mlx_bus_release(mlx_bus_t *bus) {
+    uint32_t irq_state = save_and_disable_interrupts();
+    bus->hold = false;
+    mlx_bus_next(bus);
+    restore_interrupts(irq_state);
+}
+
+/**
+ * Free a bus that a sensor is holding SDA low on (cut off mid-byte, it
+ * waits for the rest of the clocks): pulse SCL by hand until SDA is
+ * released, send a STOP and reset the I2C controller. Hold the bus first.
+ * Returns false if a line is still stuck low.
+ */
+bool mlx_bus_recover(mlx_bus_t *bus) {
+    // Open drain by hand: output low, or input to let the pull-up take it high
+    gpio_put(bus->scl_pin, 0);
+    gpio_put(bus->sda_pin, 0);
+    gpio_set_dir(bus->scl_pin, GPIO_IN);
+    gpio_set_dir(bus->sda_pin, GPIO_IN);
+    gpio_set_function(bus->scl_pin, GPIO_FUNC_SIO);
+    gpio_set_function(bus->sda_pin, GPIO_FUNC_SIO);
+    busy_wait_us(I2C_RECOVERY_HALF_US);
     
-    printf("Starting measurements...\n");
-    printf("Format: Z-axis(M1): X.XXX mT\n\n");
+    for (int i = 0; i < I2C_RECOVERY_CLOCKS && !gpio_get(bus->sda_pin); i++) {
+        gpio_set_dir(bus->scl_pin, GPIO_OUT);
+        busy_wait_us(I2C_RECOVERY_HALF_US);
+        gpio_set_dir(bus->scl_pin, GPIO_IN);
+        busy_wait_us(I2C_RECOVERY_HALF_US);
+    }
     
-    bool led_state = false;
+    // STOP: SDA rises while SCL is high
+    gpio_set_dir(bus->scl_pin, GPIO_OUT);
+    busy_wait_us(I2C_RECOVERY_HALF_US);
+    gpio_set_dir(bus->sda_pin, GPIO_OUT);
+    busy_wait_us(I2C_RECOVERY_HALF_US);
+    gpio_set_dir(bus->scl_pin, GPIO_IN);
+    busy_wait_us(I2C_RECOVERY_HALF_US);
+    gpio_set_dir(bus->sda_pin, GPIO_IN);
+    busy_wait_us(I2C_RECOVERY_HALF_US);
+    bool released = gpio_get(bus->sda_pin) && gpio_get(bus->scl_pin);
+    
+    // i2c_init() resets the block, which also clears an abort the DMA engine left behind
+    i2c_init(bus->i2c, I2C_FREQ);
+    gpio_set_function(bus->sda_pin, GPIO_FUNC_I2C);
+    gpio_set_function(bus->scl_pin, GPIO_FUNC_I2C);
+    return released;
+}
+
+/**
+ * Collect a finished read from the device mailbox. Returns false if
+ * nothing has arrived yet.
+ */
+bool mlx_take_sample(mlx_dev_t *dev, mlx_sample_t *sample, mlx_result_t *res) {
+    if (!dev->sample_ready) return false;
+    uint32_t irq_state = save_and_disable_interrupts();
+    *sample = dev->sample;
+    *res = dev->read_result;
+    dev->sample_ready = false;
+    restore_interrupts(irq_state);
+    return true;
+}
+
+// ========================================
+// BURST MODE
+// ========================================
+
+/**
+ * DRDY interrupt: a sensor has a new burst sample, queue its read.
+ */
+void mlx_drdy_callback(uint gpio, uint32_t events) {
+    (void)events;
+    for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+        if (mlx_devices[i].drdy_pin == (int8_t)gpio) {
+            mlx_devices[i].drdy_seen = true;
+            mlx_devices[i].measured_us = time_us_64();
+            mlx_request_read(&mlx_devices[i]);
+        }
+    }
+}
+
+/**
+ * Put a sensor into burst mode and enable its DRDY interrupt.
+ * BURST_DATA_RATE is left at its reset value of 0, so the sensor converts
+ * back-to-back and the conversion time sets the sample rate (WOC sets it,
+ * so it is written back to 0 here). Every burst
+ * conversion measures cfg.axes, so temp_every has no effect; add "t" to the
+ * axes to track temperature in burst mode.
+ */
+bool mlx_start_burst(mlx_dev_t *dev) {
+    if (dev->drdy_pin == MLX_NO_DRDY) return false;
+    gpio_init(dev->drdy_pin);
+    gpio_set_dir(dev->drdy_pin, GPIO_IN);
+    gpio_pull_down(dev->drdy_pin);
+    
+    if (mlx_update_register(dev, MLX90393_CONF2, MLX90393_BURST_RATE_MASK, 0) != MLX_OK) return false;
+    dev->meas_axes = dev->cfg.axes;
+    uint8_t cmd = MLX90393_REG_SB | dev->meas_axes;
+    uint8_t status;
+    if (mlx_transceive(dev, &cmd, 1, &status, 0) != MLX_OK) return false;
+    if ((status & MLX90393_STATUS_ERROR) || !(status & MLX90393_STATUS_BURST)) return false;
+    
+    dev->timeout_at = make_timeout_time_us(2 * mlx_conversion_time_us(dev, dev->cfg.axes) + MLX_CONV_TIMEOUT_US);
+    gpio_set_irq_enabled_with_callback(dev->drdy_pin, GPIO_IRQ_EDGE_RISE, true, &mlx_drdy_callback);
+    return true;
+}
+
+/**
+ * Put a sensor into wake-on-change mode: it converts Z every period_ms by
+ * itself and only raises DRDY once Z differs from the first conversion by
+ * threshold_mT, so neither the bus nor the CPU is touched while the force
+ * is unchanged. Only Z is measured, so X/Y cannot wake it.
+ */
+bool mlx_start_woc(mlx_dev_t *dev, float threshold_mT, uint32_t period_ms) {
+    if (dev->drdy_pin == MLX_NO_DRDY) return false;
+    gpio_init(dev->drdy_pin);
+    gpio_set_dir(dev->drdy_pin, GPIO_IN);
+    gpio_pull_down(dev->drdy_pin);
+    
+    // Threshold is in Z counts at the current gain/resolution
+    float lsb_mT = mlx90393_lsb_lookup[0][dev->cfg.gain][dev->cfg.res][1] / 1000.0f;
+    float counts = threshold_mT / lsb_mT;
+    uint16_t threshold = (counts < 1.0f) ? 1 : (counts > 65535.0f) ? 65535 : (uint16_t)counts;
+    uint32_t rate = period_ms / MLX90393_BURST_RATE_STEP_MS;
+    if (rate < 1) rate = 1;
+    if (rate > MLX90393_BURST_RATE_MASK) rate = MLX90393_BURST_RATE_MASK;
+    if (mlx_write_register(dev, MLX90393_WOZ_THRESHOLD, threshold) != MLX_OK) return false;
+    if (mlx_update_register(dev, MLX90393_CONF2, MLX90393_BURST_RATE_MASK | MLX90393_WOC_DIFF, (uint16_t)rate) != MLX_OK) return false;
+    
+    dev->meas_axes = MLX90393_AXIS_Z;
+    uint8_t cmd = MLX90393_REG_SW | dev->meas_axes;
+    uint8_t status;
+    if (mlx_transceive(dev, &cmd, 1, &status, 0) != MLX_OK) return false;
+    if ((status & MLX90393_STATUS_ERROR) || !(status & MLX90393_STATUS_WOC)) return false;
+    
+    dev->woc_threshold = threshold;
+    dev->woc_ref_set = false;
+    dev->woc_probe = false;
+    dev->woc_probe_ticks = POWER_WOC_PROBE_TICKS - 1;   // First check on the next tick
+    gpio_set_irq_enabled_with_callback(dev->drdy_pin, GPIO_IRQ_EDGE_RISE, true, &mlx_drdy_callback);
+    return true;
+}
+
+#endif
+
+// ========================================
+// SAMPLE QUEUE
+// ========================================
+
+bool sample_ring_push(sample_ring_t *ring, const mlx_sample_t *sample) {
+    uint32_t head = ring->head;
+    if (head - ring->tail > ring->mask) {
+        ring->dropped++;
+        return false;
+    }
+    ring->buf[head & ring->mask] = *sample;
+    __dmb();  // Publish the sample before the new head
+    ring->head = head + 1;
+    return true;
+}
+
+bool sample_ring_pop(sample_ring_t *ring, mlx_sample_t *sample) {
+    uint32_t tail = ring->tail;
+    if (tail == ring->head) return false;
+    __dmb();
+    *sample = ring->buf[tail & ring->mask];
+    __dmb();  // Finish reading before handing the slot back
+    ring->tail = tail + 1;
+    return true;
+}
+
+/**
+ * Push that discards the oldest sample when full. Only valid when producer
+ * and consumer run on the same core (the history buffer).
+ */
+void sample_ring_push_overwrite(sample_ring_t *ring, const mlx_sample_t *sample) {
+    if (ring->head - ring->tail > ring->mask) {
+        ring->tail++;
+        ring->dropped++;
+    }
+    ring->buf[ring->head & ring->mask] = *sample;
+    ring->head++;
+}
+
+uint32_t sample_ring_count(const sample_ring_t *ring) {
+    return ring->head - ring->tail;
+}
+
+// ========================================
+// CORE1: ACQUISITION
+// ========================================
+
+/**
+ * Auto-range check on a fresh sample. Only queues the step; it is written
+ * to the sensor by acq_apply_config() once the bus is free.
+ */
+void acq_auto_range(mlx_dev_t *dev, const mlx_sample_t *sample) {
+    int32_t z = abs(sample->z);
+    if (z > dev->range_down_above) {
+        dev->range_hold = 0;
+        if (dev->cfg.gain > MLX90393_GAIN_5X) dev->range_step = -1;
+    } else if (z < dev->range_up_below) {
+        if (++dev->range_hold >= AUTORANGE_HOLD_SAMPLES) dev->range_step = 1;
+    } else {
+        dev->range_hold = 0;
+    }
+}
+
+#if FORCE_SENSOR_HOST
+uint32_t host_period_us[count_of(mlx_devices)];    // Recorded sample interval, see host_replay_sample_rate()
+#endif
+
+/**
+ * Interval the sensor should deliver samples at in the current mode. In
+ * the host replay the recording sets the sample times, so its rate wins.
+ */
+uint32_t acq_nominal_period_us(const mlx_dev_t *dev) {
+#if FORCE_SENSOR_HOST
+    if (host_period_us[dev - mlx_devices] != 0) return host_period_us[dev - mlx_devices];
+#endif
+    if (acq_mode == ACQ_MODE_BURST) return mlx_conversion_time_us(dev, dev->cfg.axes);
+    return acq_period_us;
+}
+
+void acq_jitter_update(mlx_dev_t *dev, uint64_t time_us) {
+    jitter_stats_t *j = &dev->jitter;
+    if (dev->jitter_reset) {
+        memset(j, 0, sizeof(*j));
+        dev->jitter_reset = false;
+    }
+    
+    if (j->last_us != 0) {
+        uint32_t dt = (uint32_t)(time_us - j->last_us);
+        if (j->count == 0 || dt < j->min_us) j->min_us = dt;
+        if (dt > j->max_us) j->max_us = dt;
+        j->sum_us += dt;
+        j->count++;
+        
+        int32_t d = (int32_t)(dt - acq_nominal_period_us(dev)) + (JITTER_BINS / 2) * JITTER_BIN_US;
+        int32_t bin = (d < 0) ? 0 : d / JITTER_BIN_US;
+        j->hist[(bin < JITTER_BINS) ? bin : JITTER_BINS - 1]++;
+    }
+    j->last_us = time_us;
+}
+
+#if FORCE_SENSOR_HOST
+/**
+ * Host replay stand-in for acq_apply_timing(): there is no timer or sensor
+ * to reprogram, the recording sets the sample times.
+ */
+void host_apply_timing() {
+    acq_period_us = acq_period_request;
+    acq_mode = acq_mode_request;
+    for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) mlx_devices[i].jitter_reset = true;
+    acq_timing_pending = false;
+}
+#else  // The rest drives the sensor: timers, bus reads and the supervisor
+/**
+ * Count a failed measurement towards the supervisor's fail limit.
+ */
+void acq_count_failure(mlx_dev_t *dev) {
+    dev->errors++;
+    if (dev->fail_run++ == 0) dev->fail_since_us = time_us_64();
+}
+
+/**
+ * Count a failed measurement by cause. status is the sensor's status byte
+ * if it answered, for the flag counters.
+ */
+void acq_count_error(mlx_dev_t *dev, mlx_result_t res, uint8_t status) {
+    mlx_stats_t *st = &dev->stats;
+    acq_count_failure(dev);
+    switch (res) {
+    case MLX_ERR_I2C: st->i2c_nack++; return;
+    case MLX_ERR_TIMEOUT: st->i2c_timeout++; return;
+    default: st->status_err++; break;
+    }
+    if (status & MLX90393_STATUS_ERROR) st->flag_error++;
+    if (status & MLX90393_STATUS_SED) st->flag_sed++;
+    if (status & MLX90393_STATUS_RS) st->flag_rs++;
+}
+
+void acq_publish(size_t index, mlx_sample_t *sample) {
+    mlx_dev_t *dev = &mlx_devices[index];
+    sample->sensor = (uint8_t)index;
+    sample->seq = dev->seq++;
+    dev->stats.samples++;
+    dev->fail_run = 0;
+    sample_ring_push(&acq_ring, sample);
+    __sev();  // Wakes core0 if it is waiting in __wfe()
+    acq_jitter_update(dev, sample->time_us);
+    if (dev->auto_range) acq_auto_range(dev, sample);
+}
+
+/**
+ * Single mode pacing: runs on core1 (its own alarm pool), fixed rate from
+ * start to start so the period does not depend on how long a cycle takes.
+ */
+bool acq_timer_callback(repeating_timer_t *rt) {
+    (void)rt;
+    if (acq_tick) acq_ticks_missed++;
+    acq_tick = true;
+    return true;
+}
+
+/**
+ * Start a sensor in the current free-running mode (burst or WOC).
+ */
+bool acq_start_continuous(mlx_dev_t *dev) {
+    if (acq_mode == ACQ_MODE_WOC) return mlx_start_woc(dev, power.wake_mT, POWER_WOC_PERIOD_MS);
+    return mlx_start_burst(dev);
+}
+
+/**
+ * Write a new configuration to a running sensor. In burst and WOC mode the
+ * sensor is taken out of that mode for the register writes and restarted
+ * afterwards.
+ */
+mlx_result_t acq_reconfigure(mlx_dev_t *dev, const mlx_config_t *cfg) {
+    mlx_bus_t *bus = mlx_bus_of(dev);
+    bool burst = (acq_mode != ACQ_MODE_SINGLE);
+    
+    if (burst) gpio_set_irq_enabled(dev->drdy_pin, GPIO_IRQ_EDGE_RISE, false);
+    mlx_bus_acquire(bus);
+    dev->read_pending = false;
+    
+    mlx_result_t res = MLX_OK;
+    if (burst && !mlx_exit_mode(dev)) res = MLX_ERR_STATUS;
+    if (res == MLX_OK) res = mlx_configure(dev, cfg);
+    if (burst && !acq_start_continuous(dev)) res = MLX_ERR_STATUS;
+    
+    mlx_bus_release(bus);
+    return res;
+}
+
+/**
+ * Stop all acquisition and take every bus, for core1 work that needs the
+ * sensors to itself. Burst and WOC sensors are taken out of that mode.
+ */
+void acq_pause_all() {
+    bool burst = (acq_mode != ACQ_MODE_SINGLE);
+    for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+        mlx_dev_t *dev = &mlx_devices[i];
+        if (burst && dev->drdy_pin != MLX_NO_DRDY) gpio_set_irq_enabled(dev->drdy_pin, GPIO_IRQ_EDGE_RISE, false);
+    }
+    for (size_t b = 0; b < MLX_BUS_COUNT; b++) {
+        if (mlx_buses[b].used) mlx_bus_acquire(&mlx_buses[b]);
+    }
+    for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+        mlx_dev_t *dev = &mlx_devices[i];
+        dev->read_pending = false;
+        if (burst && dev->initialized) mlx_exit_mode(dev);
+    }
+}
+
+/**
+ * Undo acq_pause_all(): restart burst or WOC mode and hand the buses back.
+ * Returns false if a sensor did not go back into that mode.
+ */
+bool acq_resume_all() {
+    bool ok = true;
+    for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+        mlx_dev_t *dev = &mlx_devices[i];
+        if (acq_mode != ACQ_MODE_SINGLE && dev->initialized && !acq_start_continuous(dev)) {
+            dev->errors++;
+            ok = false;
+        }
+    }
+    for (size_t b = 0; b < MLX_BUS_COUNT; b++) {
+        if (mlx_buses[b].used) mlx_bus_release(&mlx_buses[b]);
+    }
+    return ok;
+}
+
+/**
+ * Restart the pacing timer at a new period and switch mode if needed. All
+ * sensors must run the same mode, so if any of them fails to enter burst
+ * or WOC everything stays in single mode. In WOC mode the timer only wakes
+ * core1 for housekeeping.
+ */
+void acq_set_timing(alarm_pool_t *pool, repeating_timer_t *timer, acq_mode_t mode, uint32_t period_us) {
+    cancel_repeating_timer(timer);
+    acq_period_us = period_us;
+    
+    if (mode != acq_mode) {
+        acq_pause_all();
+        acq_mode = mode;
+        if (!acq_resume_all()) {
+            acq_pause_all();
+            acq_mode = ACQ_MODE_SINGLE;
+            acq_resume_all();
+        }
+    }
+    if (acq_mode != ACQ_MODE_BURST) {
+        alarm_pool_add_repeating_timer_us(pool, -(int64_t)acq_period_us, acq_timer_callback, NULL, timer);
+    }
+    
+    // Intervals across the change say nothing about either setting
+    for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) mlx_devices[i].jitter_reset = true;
+    acq_tick = false;
+}
+
+/**
+ * Apply a mode/rate request from core0, see acq_set_timing().
+ */
+void acq_apply_timing(alarm_pool_t *pool, repeating_timer_t *timer) {
+    acq_set_timing(pool, timer, acq_mode_request, acq_period_request);
+    __dmb();  // Mode and period before the acknowledge
+    acq_timing_pending = false;
+}
+
+/**
+ * Apply configuration requests from core0 and pending auto-range steps.
+ * Called between single-mode cycles and from the burst poll loop, so no
+ * read of these sensors is in flight.
+ */
+void acq_apply_config() {
+    for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+        mlx_dev_t *dev = &mlx_devices[i];
+        if (!dev->initialized) continue;
+        
+        if (dev->cfg_pending) {
+            dev->range_step = 0;
+            dev->cfg_result = acq_reconfigure(dev, &dev->cfg_request);
+            __dmb();  // Result before the acknowledge
+            dev->cfg_pending = false;
+        } else if (dev->range_step != 0) {
+            mlx_config_t cfg = dev->cfg;
+            cfg.gain = (mlx90393_gain_t)(cfg.gain + dev->range_step);
+            dev->range_step = 0;
+            if (acq_reconfigure(dev, &cfg) != MLX_OK) dev->errors++;
+        }
+    }
+}
+
+/**
+ * One single-mode cycle over all sensors. Every sensor is started first so
+ * the conversions overlap; each is then read over DMA as soon as its own
+ * conversion time has passed, with both buses working at the same time.
+ */
+void acq_single_cycle() {
+    for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+        mlx_dev_t *dev = &mlx_devices[i];
+        dev->acq_state = MLX_ACQ_IDLE;
+        if (!dev->initialized) continue;
+        
+        // Temperature changes slowly, so T only rides along every temp_every samples
+        dev->meas_axes = dev->cfg.axes;
+        if (dev->temp_every && ++dev->temp_count >= dev->temp_every) {
+            dev->meas_axes |= MLX90393_AXIS_T;
+            dev->temp_count = 0;
+        }
+        
+        dev->measured_us = time_us_64();
+        mlx_result_t res = mlx_start_measurement(dev);
+        if (res != MLX_OK) {
+            acq_count_error(dev, res, dev->last_status);
+            continue;
+        }
+        dev->read_at = make_timeout_time_us(mlx_conversion_time_us(dev, dev->meas_axes));
+        dev->timeout_at = delayed_by_us(dev->read_at, MLX_CONV_TIMEOUT_US);
+        dev->acq_state = MLX_ACQ_CONVERTING;
+    }
+    
+    bool busy = true;
+    while (busy) {
+        busy = false;
+        for (size_t b = 0; b < MLX_BUS_COUNT; b++) {
+            mlx_bus_check_abort(&mlx_buses[b]);
+        }
+        
+        for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+            mlx_dev_t *dev = &mlx_devices[i];
+            mlx_sample_t sample;
+            mlx_result_t res;
+            
+            switch (dev->acq_state) {
+            case MLX_ACQ_CONVERTING:
+                busy = true;
+                if (time_reached(dev->read_at)) {
+                    dev->acq_state = MLX_ACQ_READING;
+                    mlx_request_read(dev);
+                }
+                break;
+            
+            case MLX_ACQ_READING:
+                busy = true;
+                if (mlx_take_sample(dev, &sample, &res)) {
+                    if (res == MLX_OK) {
+                        acq_publish(i, &sample);
+                        dev->acq_state = MLX_ACQ_IDLE;
+                    } else if (res == MLX_ERR_STATUS && !time_reached(dev->timeout_at)) {
+                        // Data not ready yet, poll again shortly
+                        dev->read_at = make_timeout_time_us(MLX_POLL_INTERVAL_US);
+                        dev->acq_state = MLX_ACQ_CONVERTING;
+                    } else if (res == MLX_ERR_STATUS) {
+                        acq_count_failure(dev);
+                        dev->stats.conv_timeout++;
+                        dev->acq_state = MLX_ACQ_IDLE;
+                    } else {
+                        acq_count_error(dev, res, sample.status);
+                        dev->acq_state = MLX_ACQ_IDLE;
+                    }
+                } else if (absolute_time_diff_us(dev->timeout_at, get_absolute_time()) > I2C_TIMEOUT_US) {
+                    // Transfer never completed
+                    mlx_bus_abort(mlx_bus_of(dev), MLX_ERR_TIMEOUT);
+                }
+                break;
+            
+            default:
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Burst mode: DRDY interrupts queue the reads, so just move finished
+ * samples to the queue. If a sensor's DRDY is high but nothing has been
+ * read for a while (missed edge), queue the read here so it cannot stall.
+ * If DRDY stays low the sensor has stopped converting (reset or unplugged),
+ * which counts as a conversion timeout.
+ */
+void acq_burst_poll() {
+    for (size_t b = 0; b < MLX_BUS_COUNT; b++) {
+        mlx_bus_check_abort(&mlx_buses[b]);
+    }
+    
+    for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+        mlx_dev_t *dev = &mlx_devices[i];
+        if (!dev->initialized) continue;
+        
+        mlx_sample_t sample;
+        mlx_result_t res;
+        if (mlx_take_sample(dev, &sample, &res)) {
+            if (res == MLX_OK) {
+                acq_publish(i, &sample);
+            } else {
+                acq_count_error(dev, res, sample.status);
+            }
+            dev->timeout_at = make_timeout_time_us(2 * mlx_conversion_time_us(dev, dev->cfg.axes) + MLX_CONV_TIMEOUT_US);
+        } else if (time_reached(dev->timeout_at)) {
+            if (!dev->read_pending && gpio_get(dev->drdy_pin)) {
+                dev->measured_us = time_us_64();
+                mlx_request_read(dev);
+            } else if (!dev->read_pending) {
+                acq_count_failure(dev);
+                dev->stats.conv_timeout++;
+            }
+            dev->timeout_at = make_timeout_time_us(2 * mlx_conversion_time_us(dev, dev->cfg.axes) + MLX_CONV_TIMEOUT_US);
+        }
+    }
+}
+
+/**
+ * WOC mode: the only DRDY edges are wake-ups. Publish the sample that woke
+ * a sensor (the start of the press) and go straight back to the active
+ * mode, before core0 has even seen it. A DRDY that is high with nothing
+ * read (missed edge) is read here on the housekeeping tick.
+ *
+ * Until a sensor's DRDY has been seen once, every POWER_WOC_PROBE_TICKS
+ * ticks also reads Z with RM. If Z has moved by the wake threshold from the
+ * first such read and still no edge came, INT is not wired: the sensor is
+ * switched to MLX_NO_DRDY (so later idles use the single mode fallback) and
+ * the read is handled as the wake-up.
+ */
+bool acq_woc_check(mlx_dev_t *dev, const mlx_sample_t *sample) {
+    dev->woc_probe = false;
+    if (dev->drdy_seen) return true;
+    if (!dev->woc_ref_set) {
+        dev->woc_ref = sample->z;
+        dev->woc_ref_set = true;
+        return false;
+    }
+    if (abs((int32_t)sample->z - dev->woc_ref) < dev->woc_threshold || gpio_get(dev->drdy_pin)) return false;
+    
+    gpio_set_irq_enabled(dev->drdy_pin, GPIO_IRQ_EDGE_RISE, false);
+    dev->drdy_pin = MLX_NO_DRDY;
+    return true;
+}
+
+void acq_woc_poll(alarm_pool_t *pool, repeating_timer_t *timer) {
+    for (size_t b = 0; b < MLX_BUS_COUNT; b++) {
+        mlx_bus_check_abort(&mlx_buses[b]);
+    }
+    
+    bool woke = false;
+    for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+        mlx_dev_t *dev = &mlx_devices[i];
+        if (!dev->initialized) continue;
+        
+        mlx_sample_t sample;
+        mlx_result_t res;
+        if (mlx_take_sample(dev, &sample, &res)) {
+            if (res != MLX_OK) {
+                dev->woc_probe = false;
+                acq_count_error(dev, res, sample.status);
+            } else if (!dev->woc_probe || acq_woc_check(dev, &sample)) {
+                if (!woke) power_woke = true;   // Before the sample, so core0 sees why it came
+                woke = true;
+                acq_publish(i, &sample);
+            }
+        } else if (acq_tick && !dev->read_pending) {
+            if (gpio_get(dev->drdy_pin)) {
+                dev->measured_us = time_us_64();
+                mlx_request_read(dev);
+            } else if (!dev->drdy_seen && ++dev->woc_probe_ticks >= POWER_WOC_PROBE_TICKS) {
+                dev->woc_probe_ticks = 0;
+                dev->woc_probe = true;
+                dev->measured_us = time_us_64();
+                mlx_request_read(dev);
+            }
+        }
+    }
+    acq_tick = false;
+    
+    if (woke) acq_set_timing(pool, timer, power.active_mode, power.active_period_us);
+}
+
+/**
+ * True if core1 has WOC work waiting and must not sleep. Reads in flight
+ * end with an interrupt, so they do not count. Call with interrupts off.
+ */
+bool acq_woc_busy() {
+    for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+        if (mlx_devices[i].sample_ready) return true;
+    }
+    return acq_tick || acq_timing_pending || supervisor_tick;
+}
+
+/**
+ * True if core1 has single mode work waiting and must not sleep: a tick,
+ * or a request from core0 that the loop only picks up between cycles.
+ * Call with interrupts off.
+ */
+bool acq_single_busy() {
+    for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+        if (mlx_devices[i].cfg_pending) return true;
+    }
+    return acq_tick || acq_timing_pending || supervisor_tick || bench_request || stats_reset;
+}
+
+/**
+ * Take a failing sensor off the acquisition loop: its DRDY interrupt and
+ * any queued read are dropped and core1 skips it until it is back up.
+ */
+void supervisor_take_down(mlx_dev_t *dev) {
+    mlx_bus_t *bus = mlx_bus_of(dev);
+    if (acq_mode != ACQ_MODE_SINGLE && dev->drdy_pin != MLX_NO_DRDY) {
+        gpio_set_irq_enabled(dev->drdy_pin, GPIO_IRQ_EDGE_RISE, false);
+    }
+    mlx_bus_acquire(bus);
+    dev->read_pending = false;
+    dev->sample_ready = false;
+    dev->initialized = false;
+    mlx_bus_release(bus);
+    
+    dev->acq_state = MLX_ACQ_IDLE;
+    dev->range_step = 0;
+    dev->fail_run = 0;
+    dev->backoff_ms = 0;
+    dev->recover_tries = 0;
+    dev->retry_at = get_absolute_time();
+}
+
+/**
+ * True if another sensor on dev's bus is up and its last measurement
+ * worked, so the bus itself is fine and only dev needs attention.
+ */
+bool supervisor_bus_healthy(const mlx_dev_t *dev) {
+    for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+        const mlx_dev_t *other = &mlx_devices[i];
+        if (other != dev && other->bus == dev->bus && other->initialized && other->fail_run == 0) return true;
+    }
+    return false;
+}
+
+/**
+ * One reinit attempt on a sensor that is down: exit mode, reset and
+ * reconfigure it (mlx_init) and restart burst or WOC mode if that is what
+ * the rest run. Other sensors on the bus wait meanwhile. Only after
+ * SUPERVISOR_BUS_RESET_AFTER failed attempts, and only while no other
+ * sensor on the bus is still answering, is the bus freed and its
+ * controller reset first. A failure doubles the wait before the next
+ * attempt.
+ */
+bool supervisor_recover(mlx_dev_t *dev) {
+    mlx_bus_t *bus = mlx_bus_of(dev);
+    mlx_bus_acquire(bus);
+    if (dev->recover_tries < UINT8_MAX) dev->recover_tries++;
+    if (dev->recover_tries > SUPERVISOR_BUS_RESET_AFTER && !supervisor_bus_healthy(dev)) {
+        mlx_bus_recover(bus);
+        dev->stats.bus_resets++;
+    }
+    bool ok = mlx_init(dev);
+    dev->initialized = false;   // Until the mode is running too
+    if (ok && acq_mode != ACQ_MODE_SINGLE) ok = acq_start_continuous(dev);
+    
+    if (ok) {
+        uint32_t took_ms = (uint32_t)((time_us_64() - dev->fail_since_us) / 1000);
+        dev->stats.recoveries++;
+        dev->stats.recovery_last_ms = took_ms;
+        if (took_ms > dev->stats.recovery_max_ms) dev->stats.recovery_max_ms = took_ms;
+        dev->temp_count = 0;
+        dev->jitter_reset = true;   // The outage is not jitter
+        __dmb();  // Recovery time before core0 sees the sensor up
+        dev->initialized = true;
+    } else {
+        dev->stats.recovery_fails++;
+        dev->backoff_ms = (dev->backoff_ms == 0) ? SUPERVISOR_BACKOFF_MIN_MS : dev->backoff_ms * 2;
+        if (dev->backoff_ms > SUPERVISOR_BACKOFF_MAX_MS) dev->backoff_ms = SUPERVISOR_BACKOFF_MAX_MS;
+        dev->retry_at = make_timeout_time_ms(dev->backoff_ms);
+    }
+    mlx_bus_release(bus);
+    return ok;
+}
+
+/**
+ * Supervisor tick, from the core1 loop between cycles: reinitialise
+ * sensors that keep failing or are down (with backoff), then feed the
+ * watchdog. Only a loop that keeps coming round here feeds it, so a hang
+ * anywhere in acquisition reboots the board.
+ */
+void supervisor_poll() {
+    supervisor_tick = false;
+    for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+        mlx_dev_t *dev = &mlx_devices[i];
+        if (dev->initialized && dev->fail_run >= SUPERVISOR_FAIL_LIMIT) supervisor_take_down(dev);
+        if (!dev->initialized && time_reached(dev->retry_at)) supervisor_recover(dev);
+    }
+    watchdog_update();
+}
+
+bool supervisor_timer_callback(repeating_timer_t *rt) {
+    (void)rt;
+    supervisor_tick = true;
+    return true;
+}
+
+void bench_core1();
+
+/**
+ * Core1 only talks to the sensors and queues timestamped raw samples, so a
+ * slow USB host on core0 cannot delay sampling. The DMA and burst mode
+ * GPIO interrupts are set up here so they are serviced on core1. It runs
+ * even if no sensor came up at boot, the supervisor keeps retrying them.
+ */
+void core1_main() {
+    // Lets core0 pause this core while it writes calibration to flash
+    multicore_lockout_victim_init();
+    mlx_dma_init();
+    
+    if (acq_mode == ACQ_MODE_BURST) {
+        for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+            mlx_dev_t *dev = &mlx_devices[i];
+            if (dev->initialized && !mlx_start_burst(dev)) {
+                acq_mode = ACQ_MODE_SINGLE;
+            }
+        }
+        if (acq_mode != ACQ_MODE_BURST) {
+            // All sensors must run the same mode. The watchdog is not running
+            // yet, so a read that hangs is aborted and the bus freed
+            for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+                mlx_dev_t *dev = &mlx_devices[i];
+                mlx_bus_t *bus = mlx_bus_of(dev);
+                if (dev->drdy_pin != MLX_NO_DRDY) gpio_set_irq_enabled(dev->drdy_pin, GPIO_IRQ_EDGE_RISE, false);
+                if (!mlx_bus_acquire(bus)) mlx_bus_recover(bus);
+                dev->read_pending = false;
+                if (dev->initialized) mlx_exit_mode(dev);
+                mlx_bus_release(bus);
+            }
+        }
+    }
+    multicore_fifo_push_blocking(acq_mode);
+    
+    // An alarm pool created here fires its callbacks on core1
+    static repeating_timer_t acq_timer;
+    static repeating_timer_t supervisor_timer;
+    alarm_pool_t *pool = alarm_pool_create(SAMPLE_TIMER_ALARM, 4);
+    if (acq_mode == ACQ_MODE_SINGLE) {
+        alarm_pool_add_repeating_timer_us(pool, -(int64_t)acq_period_us, acq_timer_callback, NULL, &acq_timer);
+    }
+    alarm_pool_add_repeating_timer_ms(pool, -SUPERVISOR_PERIOD_MS, supervisor_timer_callback, NULL, &supervisor_timer);
+    watchdog_enable(WATCHDOG_TIMEOUT_MS, true);  // Paused while a debugger halts the cores
+    
+    while (true) {
+        if (supervisor_tick) supervisor_poll();
+        acq_apply_config();
+        if (acq_timing_pending) acq_apply_timing(pool, &acq_timer);
+        if (bench_request) bench_core1();
+        if (stats_reset) {
+            for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+                memset(&mlx_devices[i].stats, 0, sizeof(mlx_stats_t));
+                mlx_devices[i].overruns = 0;
+            }
+            acq_ring.dropped = 0;
+            acq_ticks_missed = 0;
+            loop_stats.core1_max_us = 0;
+            stats_reset = false;
+        }
+        
+        uint32_t start_us = time_us_32();
+        if (acq_mode == ACQ_MODE_WOC) {
+            acq_woc_poll(pool, &acq_timer);
+            // Interrupts off so a wake-up landing between the check and WFI still ends it
+            uint32_t irq_state = save_and_disable_interrupts();
+            if (acq_mode == ACQ_MODE_WOC && !acq_woc_busy()) __wfi();
+            restore_interrupts(irq_state);
+            continue;
+        } else if (acq_mode == ACQ_MODE_BURST) {
+            acq_burst_poll();
+        } else if (acq_tick) {
+            acq_tick = false;
+            acq_single_cycle();
+        } else {
+            // Timer, DMA or lockout interrupt. Masked like WOC, so a tick landing after the check still ends the WFI
+            uint32_t irq_state = save_and_disable_interrupts();
+            if (acq_mode == ACQ_MODE_SINGLE && !acq_single_busy()) __wfi();
+            restore_interrupts(irq_state);
+            continue;
+        }
+        uint32_t took_us = time_us_32() - start_us;
+        if (took_us > loop_stats.core1_max_us) loop_stats.core1_max_us = took_us;
+    }
+}
+
+#endif
+
+// ========================================
+// OUTPUT
+// ========================================
+
+uint16_t crc16_ccitt(const uint8_t *data, size_t len) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; i++) {
+        uint8_t x = (crc >> 8) ^ data[i];
+        x ^= x >> 4;
+        crc = (crc << 8) ^ ((uint16_t)x << 12) ^ ((uint16_t)x << 5) ^ x;
+    }
+    return crc;
+}
+
+/**
+ * Write raw bytes to USB, bypassing stdio's CR/LF translation (which would
+ * corrupt any 0x0A inside a binary frame).
+ */
+void output_write(const void *data, size_t len) {
+    fflush(stdout);
+    stdio_usb.out_chars((const char *)data, (int)len);
+}
+
+/**
+ * Write out the pending batch. Anything else printed to the port must
+ * flush first so lines stay in order.
+ */
+void output_flush() {
+    if (out_len == 0) return;
+    output_write(out_buf, out_len);
+    out_len = 0;
+    out_count = 0;
+}
+
+/**
+ * Add one sample's output to the batch. The batch goes out as one USB
+ * write (one stdio lock, full packets) when it reaches out_batch_samples;
+ * output_poll() sends it once the oldest sample has waited out_batch_us.
+ */
+void output_append(const void *data, size_t len) {
+    if (out_len + len > sizeof(out_buf)) output_flush();
+    memcpy(&out_buf[out_len], data, len);
+    out_len += len;
+    if (out_count++ == 0) out_first_us = time_us_32();
+    if (out_count >= out_batch_samples) output_flush();
+}
+
+void output_poll() {
+    if (out_count > 0 && time_us_32() - out_first_us >= out_batch_us) output_flush();
+}
+
+/**
+ * Check there is a host to send a sample to. stdio_usb discards output
+ * while the port is closed, so count those samples rather than format them.
+ */
+bool output_ready() {
+    if (stdio_usb_connected()) return true;
+    loop_stats.usb_dropped++;
+    return false;
+}
+
+void output_sample_frame(const mlx_sample_t *sample, uint8_t type) {
+    sample_frame_t frame = {
+        .sync = {FRAME_SYNC0, FRAME_SYNC1},
+        .type = type,
+        .sensor = sample->sensor,
+        .seq = sample->seq,
+        .time_us = (uint32_t)sample->time_us,
+        .x = sample->x,
+        .y = sample->y,
+        .z = sample->z,
+        .status = sample->status,
+        .range = sample->range,
+    };
+    frame.crc = crc16_ccitt(&frame.type, offsetof(sample_frame_t, crc) - offsetof(sample_frame_t, type));
+    output_append(&frame, sizeof(frame));
+}
+
+// ========================================
+// CALIBRATION STORAGE
+// ========================================
+
+uint16_t cal_store_crc(const cal_store_t *store) {
+    return crc16_ccitt((const uint8_t *)store, offsetof(cal_store_t, crc));
+}
+
+/**
+ * Load the calibration record from flash and apply it to the sensors.
+ * Sensors without a committed calibration keep their compiled-in model;
+ * the tare is restored for all of them.
+ * The LUTs are built afterwards by cal_build_lut().
+ * Returns false (and starts an empty record) if flash holds no valid record.
+ */
+bool cal_store_load() {
+    const cal_store_t *stored = (const cal_store_t *)(XIP_BASE + CAL_STORE_OFFSET);
+    cal_store_loaded = stored->magic == CAL_STORE_MAGIC &&
+                       stored->version == CAL_STORE_VERSION &&
+                       stored->size == sizeof(cal_store_t) &&
+                       stored->crc == cal_store_crc(stored);
+    if (!cal_store_loaded) {
+        memset(&cal_store, 0, sizeof(cal_store));
+        return false;
+    }
+    
+    cal_store = *stored;
+    for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+        if (cal_store.sensors[i].flags & CAL_VALID) mlx_devices[i].cal = cal_store.sensors[i];
+        mlx_devices[i].z_offset = VALUE_FROM_FLOAT(cal_store.z_offset[i]);
+        mlx_devices[i].tare_track = cal_store.tare_track[i];
+    }
+    return true;
+}
+
+/**
+ * Write cal_store, with every sensor's current tare, to flash. Core1 is
+ * locked out and interrupts are off while the sector is erased and
+ * programmed (tens of ms), so the samples due in that window are late but
+ * not lost. Returns false if the read back does not match.
+ */
+bool cal_store_save() {
+    static uint8_t buf[CAL_STORE_PROGRAM_SIZE];
+    
+    for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+        cal_store.z_offset[i] = VALUE_TO_FLOAT(mlx_devices[i].z_offset);
+        cal_store.tare_track[i] = mlx_devices[i].tare_track;
+    }
+    cal_store.magic = CAL_STORE_MAGIC;
+    cal_store.version = CAL_STORE_VERSION;
+    cal_store.size = sizeof(cal_store_t);
+    cal_store.crc = cal_store_crc(&cal_store);
+    memset(buf, 0xFF, sizeof(buf));
+    memcpy(buf, &cal_store, sizeof(cal_store));
+    
+    multicore_lockout_start_blocking();
+    uint32_t irq_state = save_and_disable_interrupts();
+    flash_range_erase(CAL_STORE_OFFSET, FLASH_SECTOR_SIZE);
+    flash_range_program(CAL_STORE_OFFSET, buf, sizeof(buf));
+    restore_interrupts(irq_state);
+    multicore_lockout_end_blocking();
+    
+    cal_store_loaded = memcmp((const void *)(XIP_BASE + CAL_STORE_OFFSET), buf, sizeof(cal_store)) == 0;
+    cal_store_dirty = false;
+    cal_store_saved_us = time_us_64();
+    return cal_store_loaded;
+}
+
+/**
+ * Save a tare finished in the sample path. Called from the main loop when no
+ * sample is waiting, at most every CAL_STORE_SAVE_MIN_MS, so tares finishing
+ * together cost one sector erase and none stalls process_sample().
+ */
+void cal_store_poll() {
+    if (!cal_store_dirty || time_us_64() - cal_store_saved_us < CAL_STORE_SAVE_MIN_MS * 1000ull) return;
+    if (!cal_store_save()) {
+        output_flush();
+        printf("ERROR: tare not saved, flash write failed (active until reboot)\n");
+    }
+}
+
+// ========================================
+// CORE0: PROCESSING
+// ========================================
+
+/**
+ * Exponential moving average, equivalent to
+ * data * (1 - filter_val) + smoothed_val * filter_val with one multiply
+ */
+value_t smooth(value_t data, value_t filter_val, value_t smoothed_val) {
+    return smoothed_val + VALUE_MUL(data - smoothed_val, VALUE_ONE - filter_val);
+}
+
+// ========================================
+// FILTER CHAIN
+// ========================================
+// Per sensor, run on core0 over Z in mT: median (spike/glitch rejection),
+// biquad low-pass or notch, O(1) moving average, then the EMA. Everything
+// lives in filter_state_t, so reconfiguring never allocates.
+
+/**
+ * Median of the last len inputs. len is at most FILTER_MEDIAN_MAX, so
+ * sorting a copy is cheap and has a fixed worst case.
+ */
+value_t median_step(filter_state_t *st, uint8_t len, value_t x) {
+    st->median_buf[st->median_pos] = x;
+    if (++st->median_pos >= len) st->median_pos = 0;
+    
+    value_t sorted[FILTER_MEDIAN_MAX];
+    for (uint8_t i = 0; i < len; i++) {
+        value_t v = st->median_buf[i];
+        uint8_t j = i;
+        for (; j > 0 && sorted[j - 1] > v; j--) sorted[j] = sorted[j - 1];
+        sorted[j] = v;
+    }
+    return sorted[len / 2];
+}
+
+/**
+ * Design an RBJ cookbook low-pass or notch for the given sample rate.
+ * Returns false if the frequency is not below Nyquist.
+ */
+bool biquad_design(biquad_t *bq, biquad_type_t type, float f0, float q, float fs) {
+    if (f0 <= 0 || q <= 0 || f0 >= fs / 2) return false;
+    float w0 = 6.2831853f * f0 / fs;  // 2 pi f0 / fs
+    float cos_w0 = cosf(w0);
+    float alpha = sinf(w0) / (2.0f * q);
+    float a0 = 1.0f + alpha;
+    
+    float b0, b1, b2;
+    if (type == BIQUAD_NOTCH) {
+        b0 = 1.0f;
+        b1 = -2.0f * cos_w0;
+        b2 = 1.0f;
+    } else {
+        b0 = (1.0f - cos_w0) / 2.0f;
+        b1 = 1.0f - cos_w0;
+        b2 = (1.0f - cos_w0) / 2.0f;
+    }
+    bq->b0 = COEFF_FROM_FLOAT(b0 / a0);
+    bq->b1 = COEFF_FROM_FLOAT(b1 / a0);
+    bq->b2 = COEFF_FROM_FLOAT(b2 / a0);
+    bq->a1 = COEFF_FROM_FLOAT(-2.0f * cos_w0 / a0);
+    bq->a2 = COEFF_FROM_FLOAT((1.0f - alpha) / a0);
+    return true;
+}
+
+value_t biquad_step(biquad_t *bq, value_t x) {
+#if USE_FIXED_POINT
+    int64_t acc = (int64_t)bq->b0 * x + (int64_t)bq->b1 * bq->x1 + (int64_t)bq->b2 * bq->x2
+                - (int64_t)bq->a1 * bq->y1 - (int64_t)bq->a2 * bq->y2;
+    value_t y = (value_t)(acc >> COEFF_FRAC_BITS);
+#else
+    value_t y = bq->b0 * x + bq->b1 * bq->x1 + bq->b2 * bq->x2 - bq->a1 * bq->y1 - bq->a2 * bq->y2;
+#endif
+    bq->x2 = bq->x1;
+    bq->x1 = x;
+    bq->y2 = bq->y1;
+    bq->y1 = y;
+    return y;
+}
+
+/**
+ * Sliding-window mean with a running sum. The float build re-sums once per
+ * window so rounding errors cannot build up; that stays O(1) amortised.
+ */
+value_t mean_step(filter_state_t *st, uint8_t len, value_t x) {
+    st->mean_sum += x - st->mean_buf[st->mean_pos];
+    st->mean_buf[st->mean_pos] = x;
+    if (++st->mean_pos >= len) {
+        st->mean_pos = 0;
+#if !USE_FIXED_POINT
+        st->mean_sum = 0;
+        for (uint8_t i = 0; i < len; i++) st->mean_sum += st->mean_buf[i];
+#endif
+    }
+    return (value_t)(st->mean_sum / len);
+}
+
+/**
+ * Sample rate the filters are designed for: measured once available,
+ * otherwise what the acquisition mode should deliver.
+ */
+float filter_rate_hz(const mlx_dev_t *dev) {
+    if (dev->sample_rate_hz > 0) return dev->sample_rate_hz;
+    if (acq_mode == ACQ_MODE_BURST) return 1e6f / mlx_conversion_time_us(dev, dev->cfg.axes);
+    return 1e6f / acq_period_us;
+}
+
+/**
+ * (Re)start a sensor's chain from a first value so no stage starts with a
+ * step from zero. Returns false if the biquad can't be designed at the
+ * current sample rate (it is then left off).
+ */
+bool filter_reset(mlx_dev_t *dev, value_t x) {
+    const filter_config_t *cfg = &dev->filter;
+    filter_state_t *st = &dev->filter_state;
+    bool ok = true;
+    
+    for (int i = 0; i < FILTER_MEDIAN_MAX; i++) st->median_buf[i] = x;
+    st->median_pos = 0;
+    
+    st->bq_rate_hz = filter_rate_hz(dev);
+    if (cfg->biquad != BIQUAD_OFF) {
+        ok = biquad_design(&st->bq, cfg->biquad, cfg->biquad_hz, cfg->biquad_q, st->bq_rate_hz);
+    }
+    // Both filters have unity gain at DC, so settle the state on x
+    st->bq.x1 = st->bq.x2 = st->bq.y1 = st->bq.y2 = x;
+    
+    for (int i = 0; i < FILTER_MEAN_MAX; i++) st->mean_buf[i] = x;
+    st->mean_pos = 0;
+    st->mean_sum = (value_acc_t)x * (cfg->mean_len ? cfg->mean_len : 1);
+    
+    st->ema_weight = VALUE_FROM_FLOAT(cfg->ema);
+    st->out = x;
+    dev->has_reading = true;
+    return ok;
+}
+
+/**
+ * Track the actual sample rate from the sample timestamps and redesign the
+ * biquad when it moves by more than FILTER_RATE_TOLERANCE.
+ */
+void filter_track_rate(mlx_dev_t *dev, uint64_t time_us) {
+    if (dev->rate_n++ == 0) {
+        dev->rate_t0 = time_us;
+        return;
+    }
+    if (dev->rate_n <= FILTER_RATE_WINDOW || time_us <= dev->rate_t0) return;
+    
+    dev->sample_rate_hz = FILTER_RATE_WINDOW * 1e6f / (float)(time_us - dev->rate_t0);
+    dev->rate_t0 = time_us;
+    dev->rate_n = 1;
+    
+    const filter_config_t *cfg = &dev->filter;
+    filter_state_t *st = &dev->filter_state;
+    if (cfg->biquad != BIQUAD_OFF &&
+        fabsf(dev->sample_rate_hz - st->bq_rate_hz) > FILTER_RATE_TOLERANCE * st->bq_rate_hz) {
+        // Keep the state, only the coefficients move
+        if (biquad_design(&st->bq, cfg->biquad, cfg->biquad_hz, cfg->biquad_q, dev->sample_rate_hz)) {
+            st->bq_rate_hz = dev->sample_rate_hz;
+        }
+    }
+}
+
+/**
+ * Run one Z value through the sensor's chain (only the constant EMA in a
+ * fixed config build without FORCE_SENSOR_RUNTIME_CAL).
+ */
+value_t filter_step(mlx_dev_t *dev, value_t x) {
+    const filter_config_t *cfg = &dev->filter;
+    filter_state_t *st = &dev->filter_state;
+    
+#if FIXED_PROCESSING
+    (void)cfg;
+    if (FIXED_FILTER_EMA > 0) x = smooth(x, VALUE_FROM_FLOAT(FIXED_FILTER_EMA), st->out);
+#else
+    if (cfg->median_len > 1) x = median_step(st, cfg->median_len, x);
+    if (cfg->biquad != BIQUAD_OFF) x = biquad_step(&st->bq, x);
+    if (cfg->mean_len > 1) x = mean_step(st, cfg->mean_len, x);
+    if (st->ema_weight > 0) x = smooth(x, st->ema_weight, st->out);
+#endif
+    st->out = x;
+    return x;
+}
+
+/**
+ * Evaluate a calibration model in float. PWL models extend their first and
+ * last segment beyond the knots.
+ */
+float cal_model_eval(const cal_model_t *model, float z) {
+    if (model->type == CAL_MODEL_PWL) {
+        const float *k = model->coeffs;
+        size_t seg = 0;
+        while (seg + 2 < model->count && z > k[2 * (seg + 1)]) seg++;
+        float z0 = k[2 * seg], f0 = k[2 * seg + 1];
+        float z1 = k[2 * seg + 2], f1 = k[2 * seg + 3];
+        return f0 + (f1 - f0) * (z - z0) / (z1 - z0);
+    }
+    
+    float f = 0;
+    for (int i = model->count - 1; i >= 0; i--) {
+        f = f * z + model->coeffs[i];
+    }
+    return f;
+}
+
+/**
+ * Recompute the Z correction for the last temperature reading, so applying
+ * it per sample is one subtraction. 0 until a temperature is known.
+ */
+void cal_update_temp_comp(mlx_dev_t *dev) {
+    float comp = dev->has_temp ? dev->cal.temp_coeff * (dev->temp_c - dev->cal.temp_ref_c) : 0.0f;
+    dev->temp_comp_mT = VALUE_FROM_FLOAT(comp);
+}
+
+/**
+ * Record a temperature reading for the sensor's drift correction
+ */
+void cal_set_temp(mlx_dev_t *dev, float temp_c) {
+    dev->temp_c = temp_c;
+    dev->has_temp = true;
+    cal_update_temp_comp(dev);
+}
+
+/**
+ * Z where the LUT crosses 0 N, extending the end segments like
+ * calculate_force() if the model does not cross inside its span. This is
+ * what "tare" moves an unloaded reading to.
+ */
+value_t cal_zero_z(const mlx_dev_t *dev) {
+    const cal_model_t *model = &dev->cal;
+    float step = (model->z_max - model->z_min) / (CAL_LUT_SIZE - 1);
+    
+    // First segment that changes sign, else whichever end is nearer 0 N
+    int i = -1;
+    for (int j = 0; j < CAL_LUT_SIZE - 1 && i < 0; j++) {
+        if ((dev->cal_lut[j] > 0) != (dev->cal_lut[j + 1] > 0)) i = j;
+    }
+    if (i < 0) {
+        bool low = fabsf(VALUE_TO_FLOAT(dev->cal_lut[0])) <= fabsf(VALUE_TO_FLOAT(dev->cal_lut[CAL_LUT_SIZE - 1]));
+        i = low ? 0 : CAL_LUT_SIZE - 2;
+    }
+    
+    float f0 = VALUE_TO_FLOAT(dev->cal_lut[i]);
+    float f1 = VALUE_TO_FLOAT(dev->cal_lut[i + 1]);
+    if (f1 == f0) return VALUE_FROM_FLOAT(model->z_min);
+    return VALUE_FROM_FLOAT(model->z_min + (i - f0 / (f1 - f0)) * step);
+}
+
+/**
+ * Sample the device's calibration model into its uniformly spaced force
+ * LUT, so calculate_force() costs the same for any model, and refresh the
+ * temperature correction and zero-force Z. Call after the model changes.
+ */
+void cal_build_lut(mlx_dev_t *dev) {
+    const cal_model_t *model = &dev->cal;
+    float step = (model->z_max - model->z_min) / (CAL_LUT_SIZE - 1);
+    for (int i = 0; i < CAL_LUT_SIZE; i++) {
+        dev->cal_lut[i] = VALUE_FROM_FLOAT(cal_model_eval(model, model->z_min + i * step));
+    }
+    dev->cal_lut_z0 = VALUE_FROM_FLOAT(model->z_min);
+    dev->cal_lut_scale = VALUE_FROM_FLOAT(1.0f / step);
+    dev->cal_zero_z = cal_zero_z(dev);
+    cal_update_temp_comp(dev);
+}
+
+/**
+ * Calculate force from Z-axis reading using the sensor's calibration LUT.
+ * Linear interpolation between entries; outside the calibrated span the end
+ * segments are extended, which keeps linear models exact everywhere.
+ * Fixed config builds without FORCE_SENSOR_RUNTIME_CAL evaluate their
+ * constant linear model directly.
+ */
+value_t calculate_force(const mlx_dev_t *dev, value_t z_axis_mT) {
+#if FIXED_PROCESSING
+    (void)dev;
+    value_t force = VALUE_MUL(z_axis_mT, VALUE_FROM_FLOAT(FIXED_CAL_SLOPE)) + VALUE_FROM_FLOAT(FIXED_CAL_INTERCEPT);
+#else
+    value_t pos = VALUE_MUL(z_axis_mT - dev->cal_lut_z0, dev->cal_lut_scale);
+    int32_t i = VALUE_FLOOR(pos);
+    if (i < 0) i = 0;
+    if (i > CAL_LUT_SIZE - 2) i = CAL_LUT_SIZE - 2;
+    value_t frac = pos - VALUE_FROM_INT(i);
+    
+    value_t force = dev->cal_lut[i] + VALUE_MUL(dev->cal_lut[i + 1] - dev->cal_lut[i], frac);
+#endif
+    // Clamp to non-negative values
+    return (force < 0) ? 0 : force;
+}
+
+/**
+ * R^2 of a model against the session's recorded points, 0 if there are
+ * fewer than two.
+ */
+float cal_r_squared(const cal_session_t *session, const cal_model_t *model) {
+    size_t n = session->count;
+    if (n < 2) return 0.0f;
+    
+    double mean_f = 0;
+    for (size_t i = 0; i < n; i++) mean_f += session->points[i].force_n;
+    mean_f /= n;
+    
+    double ss_res = 0, ss_tot = 0;
+    for (size_t i = 0; i < n; i++) {
+        double r = session->points[i].force_n - cal_model_eval(model, session->points[i].z_mT);
+        double d = session->points[i].force_n - mean_f;
+        ss_res += r * r;
+        ss_tot += d * d;
+    }
+    return (ss_tot > 0) ? (float)(1.0 - ss_res / ss_tot) : 0.0f;
+}
+
+/**
+ * Z span of the recorded points, false if they are all at the same Z.
+ */
+bool cal_points_span(const cal_session_t *session, float *z_min, float *z_max) {
+    if (session->count < 2) return false;
+    *z_min = *z_max = session->points[0].z_mT;
+    for (size_t i = 1; i < session->count; i++) {
+        if (session->points[i].z_mT < *z_min) *z_min = session->points[i].z_mT;
+        if (session->points[i].z_mT > *z_max) *z_max = session->points[i].z_mT;
+    }
+    return *z_max > *z_min;
+}
+
+/**
+ * Least-squares line through the recorded points, Force = slope * Z + intercept.
+ * Needs two points with different Z.
+ */
+bool cal_fit_linear(const cal_session_t *session, cal_model_t *fit) {
+    size_t n = session->count;
+    float z_min, z_max;
+    if (!cal_points_span(session, &z_min, &z_max)) return false;
+    
+    double mean_z = 0, mean_f = 0;
+    for (size_t i = 0; i < n; i++) {
+        mean_z += session->points[i].z_mT;
+        mean_f += session->points[i].force_n;
+    }
+    mean_z /= n;
+    mean_f /= n;
+    
+    double s_zz = 0, s_zf = 0;
+    for (size_t i = 0; i < n; i++) {
+        double dz = session->points[i].z_mT - mean_z;
+        s_zz += dz * dz;
+        s_zf += dz * (session->points[i].force_n - mean_f);
+    }
+    double slope = s_zf / s_zz;
+    
+    memset(fit, 0, sizeof(*fit));
+    fit->type = CAL_MODEL_POLY;
+    fit->count = 2;
+    fit->coeffs[0] = (float)(mean_f - slope * mean_z);
+    fit->coeffs[1] = (float)slope;
+    fit->z_min = z_min;
+    fit->z_max = z_max;
+    fit->r_squared = cal_r_squared(session, fit);
+    fit->flags = CAL_VALID;
+    return true;
+}
+
+/**
+ * Piecewise-linear model through the recorded points, sorted by Z. Points
+ * at the same Z are averaged into one knot.
+ */
+bool cal_fit_pwl(const cal_session_t *session, cal_model_t *fit) {
+    float z_min, z_max;
+    if (!cal_points_span(session, &z_min, &z_max)) return false;
+    
+    cal_point_t sorted[CAL_MAX_POINTS];
+    size_t n = session->count;
+    memcpy(sorted, session->points, n * sizeof(cal_point_t));
+    for (size_t i = 1; i < n; i++) {
+        cal_point_t p = sorted[i];
+        size_t j = i;
+        for (; j > 0 && sorted[j - 1].z_mT > p.z_mT; j--) sorted[j] = sorted[j - 1];
+        sorted[j] = p;
+    }
+    
+    memset(fit, 0, sizeof(*fit));
+    fit->type = CAL_MODEL_PWL;
+    for (size_t i = 0; i < n;) {
+        size_t j = i;
+        float sum = 0;
+        for (; j < n && sorted[j].z_mT == sorted[i].z_mT; j++) sum += sorted[j].force_n;
+        fit->coeffs[2 * fit->count] = sorted[i].z_mT;
+        fit->coeffs[2 * fit->count + 1] = sum / (j - i);
+        fit->count++;
+        i = j;
+    }
+    fit->z_min = z_min;
+    fit->z_max = z_max;
+    fit->r_squared = cal_r_squared(session, fit);
+    fit->flags = CAL_VALID;
+    return true;
+}
+
+/**
+ * Feed a raw (unsmoothed) Z reading to a "cal add" in progress and record
+ * the point once CAL_SAMPLES_PER_POINT readings are in.
+ */
+void cal_feed(size_t index, value_t z_mT) {
+    cal_session_t *session = &cal_sessions[index];
+    if (session->collect_remaining == 0) return;
+    
+    session->collect_sum += VALUE_TO_FLOAT(z_mT);
+    session->collect_n++;
+    if (--session->collect_remaining > 0) return;
+    
+    cal_point_t *point = &session->points[session->count++];
+    point->force_n = session->collect_force_n;
+    point->z_mT = session->collect_sum / session->collect_n;
+    output_flush();
+    printf("OK cal %s point %u %.3f N %.3f mT\n", mlx_devices[index].label,
+           session->count, point->force_n, point->z_mT);
+}
+
+/**
+ * Feed an uncorrected Z reading and its temperature to a "cal temp" run.
+ * Sums are kept relative to the first reading so the float inputs do not
+ * lose precision against large totals.
+ */
+void cal_feed_temp(size_t index, float temp_c, value_t z_mT) {
+    cal_session_t *session = &cal_sessions[index];
+    if (!session->temp_collecting) return;
+    
+    float z = VALUE_TO_FLOAT(z_mT);
+    if (session->temp_n == 0) {
+        session->temp_t0 = session->temp_min_c = session->temp_max_c = temp_c;
+        session->temp_z0 = z;
+    }
+    double t = temp_c - session->temp_t0;
+    double dz = z - session->temp_z0;
+    session->temp_sum_t += t;
+    session->temp_sum_z += dz;
+    session->temp_sum_tt += t * t;
+    session->temp_sum_tz += t * dz;
+    session->temp_n++;
+    if (temp_c < session->temp_min_c) session->temp_min_c = temp_c;
+    if (temp_c > session->temp_max_c) session->temp_max_c = temp_c;
+}
+
+/**
+ * End a "cal temp" run with a least-squares slope of Z against temperature.
+ * The reference is the run's mean temperature, so a force model fitted
+ * around that temperature stays valid. False if the temperature moved less
+ * than CAL_TEMP_MIN_SPAN_C.
+ */
+bool cal_fit_temp(cal_session_t *session) {
+    session->temp_collecting = false;
+    if (session->temp_n < 2 || session->temp_max_c - session->temp_min_c < CAL_TEMP_MIN_SPAN_C) return false;
+    
+    double n = session->temp_n;
+    double mean_t = session->temp_sum_t / n;
+    double s_tt = session->temp_sum_tt - n * mean_t * mean_t;
+    double s_tz = session->temp_sum_tz - mean_t * session->temp_sum_z;
+    session->temp_coeff = (float)(s_tz / s_tt);
+    session->temp_ref_c = (float)(session->temp_t0 + mean_t);
+    session->temp_valid = true;
+    return true;
+}
+
+void print_tare(const mlx_dev_t *dev, const char *note);
+
+/**
+ * Zero offset upkeep for one reading (after temperature correction). A
+ * "tare" in progress averages TARE_SAMPLES readings, moves the offset so
+ * their mean lands on the model's zero-force Z and saves it. Otherwise, with
+ * tracking on, EMAs of Z and of its deviation are updated and, while Z is
+ * within TARE_TRACK_BAND_MT of zero force and quieter than
+ * TARE_TRACK_QUIET_MT, the offset creeps 1/2^TARE_TRACK_SHIFT of the way
+ * to zero per sample. A load being applied is not quiet, and one held is
+ * outside the band, so neither gets tared away.
+ */
+void tare_feed(mlx_dev_t *dev, value_t z) {
+    if (dev->tare_remaining > 0) {
+        dev->tare_sum += z;
+        dev->tare_n++;
+        if (--dev->tare_remaining > 0) return;
+        dev->z_offset += dev->cal_zero_z - (value_t)(dev->tare_sum / dev->tare_n);
+        dev->track_primed = false;
+        cal_store_dirty = true;     // Flash is written from the main loop, see cal_store_poll()
+        output_flush();
+        print_tare(dev, "");
+        return;
+    }
+    if (!dev->tare_track) return;
+    
+    if (!dev->track_primed) {
+        // Start out noisy, so the mean settles before the first step
+        dev->track_mean = z;
+        dev->track_dev = 4 * VALUE_FROM_FLOAT(TARE_TRACK_QUIET_MT);
+        dev->track_carry = 0;
+        dev->track_primed = true;
+        return;
+    }
+    value_t d = z - dev->track_mean;
+    dev->track_mean += VALUE_MUL(d, VALUE_FROM_FLOAT(1.0f / TARE_TRACK_WINDOW));
+    dev->track_dev += VALUE_MUL(((d < 0) ? -d : d) - dev->track_dev, VALUE_FROM_FLOAT(1.0f / TARE_TRACK_WINDOW));
+    
+    value_t err = dev->cal_zero_z - dev->track_mean;
+    if (dev->track_dev >= VALUE_FROM_FLOAT(TARE_TRACK_QUIET_MT)) return;
+    if (err > VALUE_FROM_FLOAT(TARE_TRACK_BAND_MT) || err < -VALUE_FROM_FLOAT(TARE_TRACK_BAND_MT)) return;
+#if USE_FIXED_POINT
+    // Carry the remainder so steps below one LSB still add up
+    dev->track_carry += err;
+    value_t step = dev->track_carry / (1 << TARE_TRACK_SHIFT);
+    dev->track_carry -= step * (1 << TARE_TRACK_SHIFT);
+#else
+    value_t step = err / (1 << TARE_TRACK_SHIFT);
+#endif
+    dev->z_offset += step;
+    dev->track_mean += step;
+}
+
+/**
+ * Format a value with 3 decimals. The fixed-point build does this with
+ * integer maths so printf never sees a float.
+ */
+void format_value(char *buf, size_t len, value_t v) {
+#if USE_FIXED_POINT
+    int64_t milli = ((int64_t)v * 1000 + ((v < 0) ? -(VALUE_ONE / 2) : (VALUE_ONE / 2))) / VALUE_ONE;
+    const char *sign = (milli < 0) ? "-" : "";
+    if (milli < 0) milli = -milli;
+    snprintf(buf, len, "%s%ld.%03ld", sign, (long)(milli / 1000), (long)(milli % 1000));
+#else
+    snprintf(buf, len, "%.3f", v);
+#endif
+}
+
+// ========================================
+// TRIGGER CAPTURE
+// ========================================
+// Armed, the sampler runs at its fastest rate but only every idle_us per
+// sensor is streamed. Around a trigger the full-rate window is kept and
+// sent as "OK event ..." followed by FRAME_TYPE_EVENT frames (raw, as in
+// "dump"), whatever the output format.
+
+/**
+ * Start a fresh capture: empty window, and no trigger until the signal
+ * has been seen below the level.
+ */
+void trigger_rearm() {
+    trigger.capturing = false;
+    trigger.rearmed = false;
+    trigger.pre_pos = 0;
+    trigger.pre_count = 0;
+    trigger.post_count = 0;
+    trigger.t_prev = 0;
+}
+
+void trigger_send() {
+    trigger.events++;
+    if (!output_streaming) return;
+    
+    mlx_dev_t *dev = &mlx_devices[trigger.sensor];
+    output_flush();
+    printf("OK event %s %lu samples %u pre %u\n", dev->label, (unsigned long)trigger.events,
+           trigger.pre_count + trigger.post_count, trigger.pre_count);
+    
+    // Oldest pre-trigger sample first
+    uint16_t first = (trigger.pre_count < trigger.pre) ? 0 : trigger.pre_pos;
+    for (uint16_t i = 0; i < trigger.pre_count; i++) {
+        output_sample_frame(&trigger_buf[(first + i) % trigger.pre], FRAME_TYPE_EVENT);
+    }
+    for (uint16_t i = 0; i < trigger.post_count; i++) {
+        output_sample_frame(&trigger_buf[trigger.pre + i], FRAME_TYPE_EVENT);
+    }
+    output_flush();
+}
+
+/**
+ * Does this sample cross the trigger level? Updates the dZ/dt history.
+ */
+bool trigger_check(const mlx_dev_t *dev, const mlx_sample_t *sample, value_t z) {
+    if (trigger.mode == TRIGGER_FORCE) return calculate_force(dev, z) >= trigger.level;
+    
+    bool hit = false;
+    if (trigger.t_prev != 0) {
+        // |dz| / dt >= level, without the division
+        value_t dz = z - trigger.z_prev;
+        if (dz < 0) dz = -dz;
+        uint32_t dt_us = (uint32_t)(sample->time_us - trigger.t_prev);
+        hit = (value_acc_t)dz * 1000000 >= (value_acc_t)trigger.level * dt_us;
+    }
+    trigger.z_prev = z;
+    trigger.t_prev = sample->time_us;
+    return hit;
+}
+
+/**
+ * Feed a sample into the capture. Returns whether the sample should also
+ * go to the normal stream (idle rate reporting).
+ */
+bool trigger_feed(mlx_dev_t *dev, const mlx_sample_t *sample, value_t z) {
+    if (trigger.mode == TRIGGER_OFF) return true;
+    
+    if (sample->sensor == trigger.sensor) {
+        if (!trigger.capturing) {
+            bool hit = trigger_check(dev, sample, z);
+            if (hit && trigger.rearmed) {
+                trigger.capturing = true;
+            } else {
+                if (!hit) trigger.rearmed = true;
+                if (trigger.pre > 0) {
+                    trigger_buf[trigger.pre_pos] = *sample;
+                    trigger.pre_pos = (trigger.pre_pos + 1) % trigger.pre;
+                    if (trigger.pre_count < trigger.pre) trigger.pre_count++;
+                }
+            }
+        }
+        
+        if (trigger.capturing) {
+            trigger_buf[trigger.pre + trigger.post_count++] = *sample;
+            if (trigger.post_count >= trigger.post) {
+                trigger_send();
+                trigger_rearm();
+            }
+            return false;
+        }
+    }
+    
+    if (sample->time_us - dev->reported_us < trigger.idle_us) return false;
+    dev->reported_us = sample->time_us;
+    return true;
+}
+
+// ========================================
+// ADAPTIVE POWER
+// ========================================
+// Core0 watches for the force going idle and hands the sensors over to
+// wake-on-change; core1 brings them back (acq_woc_poll()). Without DRDY
+// the WOC start fails and acq_set_timing() falls back to single mode at
+// POWER_IDLE_PERIOD_US, which core0 then leaves on the first change. A
+// DRDY pin that is configured but not wired is found by acq_woc_check().
+// Dormant mode would also stop USB, so both cores use WFI/WFE sleep.
+
+/**
+ * Queue a mode/rate change for core1 without waiting for it, for use from
+ * the sample path. False if another request is still pending.
+ */
+bool acq_post_timing(acq_mode_t mode, uint32_t period_us) {
+    if (acq_timing_pending) return false;
+    acq_mode_request = mode;
+    acq_period_request = period_us;
+    __dmb();  // Request before the flag
+    acq_timing_pending = true;
+    return true;
+}
+
+/**
+ * Leave the idle state on demand (a command changing the rate or mode).
+ * Returns the mode to request instead of ACQ_MODE_WOC.
+ */
+acq_mode_t power_wake_mode(acq_mode_t mode) {
+    if (mode == ACQ_MODE_WOC) mode = power.idle ? power.active_mode : ACQ_MODE_SINGLE;
+    power.idle = false;
+    power.active_us = time_us_64();
+    return mode;
+}
+
+/**
+ * Activity tracking for one (corrected) reading. Any sensor moving by more
+ * than POWER_IDLE_BAND_MT from where it last moved keeps the rig active;
+ * after idle_ms of none the sensors go to WOC.
+ */
+void power_feed(mlx_dev_t *dev, value_t z) {
+    if (!power.adaptive) return;
+    
+    uint64_t now = time_us_64();
+    value_t d = z - dev->power_ref;
+    bool moved = d > VALUE_FROM_FLOAT(POWER_IDLE_BAND_MT) || d < -VALUE_FROM_FLOAT(POWER_IDLE_BAND_MT);
+    if (moved) {
+        dev->power_ref = z;
+        power.active_us = now;
+    }
+    
+    if (power.idle) {
+        if (power_woke) {
+            // Core1 is already back at the active rate
+            power_woke = false;
+            power.idle = false;
+        } else if (moved && acq_mode == ACQ_MODE_SINGLE && acq_post_timing(power.active_mode, power.active_period_us)) {
+            power.idle = false;     // Single mode fallback, core0 has to wake it
+        }
+    } else if (now - power.active_us >= (uint64_t)power.idle_ms * 1000 && acq_mode != ACQ_MODE_WOC) {
+        power.active_mode = acq_mode;
+        power.active_period_us = acq_period_us;
+        __dmb();  // Restore point before core1 can act on the request
+        if (acq_post_timing(ACQ_MODE_WOC, POWER_IDLE_PERIOD_US)) {
+            power_woke = false;
+            power.idle = true;
+        }
+    }
+}
+
+#if !FORCE_SENSOR_HOST  // Times the real hardware, the replay build uses perf instead
+// ========================================
+// BENCHMARK
+// ========================================
+// Each stage runs N times and is timed with the SysTick cycle counter of
+// the core it runs on. SysTick is 24 bits (~130 ms at 125 MHz), so the
+// conversion wait, which can be longer, is timed in us and scaled.
+// Acquisition is paused for the sensor stages.
+
+const char *const bench_stage_names[BENCH_STAGES] = {
+    "i2c_sm", "conv_wait", "i2c_rm", "dma_rm", "convert", "smooth", "filter", "force", "format", "usb",
+};
+
+void bench_timer_start() {
+    systick_hw->rvr = 0x00FFFFFF;
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0x5;      // Enable, processor clock
+}
+
+uint32_t bench_now() {
+    return systick_hw->cvr;
+}
+
+uint32_t bench_elapsed(uint32_t start) {
+    return (start - systick_hw->cvr) & 0x00FFFFFF;  // Counts down
+}
+
+/**
+ * Core1 side of "bench": SM, conversion wait, blocking RM and the DMA read
+ * on the selected sensor, with every sensor paused.
+ */
+void bench_core1() {
+    mlx_dev_t *dev = &mlx_devices[bench_sensor];
+    uint32_t n = bench_request;
+    uint32_t conv_us = mlx_conversion_time_us(dev, dev->cfg.axes);
+    uint32_t cycles_per_us = clock_get_hz(clk_sys) / 1000000;
+    bool ok = dev->initialized;
+    
+    acq_pause_all();
+    dev->meas_axes = dev->cfg.axes;
+    bench_timer_start();
+    for (uint32_t i = 0; i < n && ok; i++) {
+        mlx_sample_t sample;
+        watchdog_update();  // Slow conversions times BENCH_MAX_ITER can outlast the timeout
+        uint32_t t = bench_now();
+        ok = (mlx_start_measurement(dev) == MLX_OK);
+        bench_cycles[BENCH_I2C_SM][i] = bench_elapsed(t);
+        
+        uint64_t start_us = time_us_64();
+        uint64_t deadline = start_us + conv_us + MLX_CONV_TIMEOUT_US;
+        mlx_result_t res = MLX_ERR_STATUS;
+        while (ok && time_us_64() < deadline) {
+            uint32_t t_rm = bench_now();
+            res = mlx_read_sample(dev, &sample);
+            bench_cycles[BENCH_I2C_RM][i] = bench_elapsed(t_rm);
+            if (res != MLX_ERR_STATUS) break;
+            busy_wait_us(MLX_POLL_INTERVAL_US);
+        }
+        bench_cycles[BENCH_CONV_WAIT][i] = (uint32_t)(time_us_64() - start_us) * cycles_per_us;
+        ok = ok && (res == MLX_OK);
+        
+        // Same again through the DMA engine, with the bus handed back for the read
+        ok = ok && (mlx_start_measurement(dev) == MLX_OK);
+        busy_wait_us(conv_us);
+        mlx_bus_t *bus = mlx_bus_of(dev);
+        dev->sample_ready = false;
+        t = bench_now();
+        bus->hold = false;
+        mlx_request_read(dev);
+        deadline = time_us_64() + I2C_TIMEOUT_US;
+        while (ok && !mlx_take_sample(dev, &sample, &res)) {
+            mlx_bus_check_abort(bus);
+            if (time_us_64() > deadline) mlx_bus_abort(bus, MLX_ERR_TIMEOUT);
+        }
+        bench_cycles[BENCH_DMA_RM][i] = bench_elapsed(t);
+        bus->hold = true;
+        ok = ok && (res == MLX_OK);
+    }
+    acq_resume_all();
+    
+    // The pause is not jitter, and a tick that fired meanwhile is stale
+    for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) mlx_devices[i].jitter_reset = true;
+    acq_tick = false;
+    
+    bench_ok = ok;
+    __dmb();  // Results before the acknowledge
+    bench_request = 0;
+}
+
+int bench_compare(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+void bench_report(bench_stage_t stage, uint32_t n, float cycles_per_us) {
+    uint32_t *c = bench_cycles[stage];
+    uint64_t sum = 0;
+    qsort(c, n, sizeof(c[0]), bench_compare);
+    for (uint32_t i = 0; i < n; i++) sum += c[i];
+    printf("OK bench %s n %lu min %.2f avg %.2f p99 %.2f max %.2f us\n", bench_stage_names[stage], (unsigned long)n,
+           c[0] / cycles_per_us, (double)sum / n / cycles_per_us,
+           c[(n - 1) * 99 / 100] / cycles_per_us, c[n - 1] / cycles_per_us);
+}
+
+/**
+ * Core0 side of "bench": the processing and output stages, on a copy of
+ * the sensor so its live filter state is untouched.
+ */
+void bench_core0(size_t index, uint32_t n) {
+    static mlx_dev_t dev;
+    dev = mlx_devices[index];
+    mlx_sample_t sample = {.range = MLX_RANGE(dev.cfg.gain, dev.cfg.res), .z = 1000};
+    value_t z = mlx_z_to_mT(&dev, &sample);
+    volatile value_t sink;
+    char line[64];
+    char z_str[16];
+    char force_str[16];
+    if (!dev.has_reading) filter_reset(&dev, z);
+    
+    bench_timer_start();
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t t = bench_now();
+        sink = mlx_z_to_mT(&dev, &sample);
+        bench_cycles[BENCH_CONVERT][i] = bench_elapsed(t);
+        
+        t = bench_now();
+        sink = smooth(z, dev.filter_state.ema_weight, dev.filter_state.out);
+        bench_cycles[BENCH_SMOOTH][i] = bench_elapsed(t);
+        
+        t = bench_now();
+        sink = filter_step(&dev, z);
+        bench_cycles[BENCH_FILTER][i] = bench_elapsed(t);
+        
+        t = bench_now();
+        sink = calculate_force(&dev, z);
+        bench_cycles[BENCH_FORCE][i] = bench_elapsed(t);
+        
+        t = bench_now();
+        format_value(z_str, sizeof(z_str), z);
+        format_value(force_str, sizeof(force_str), sink);
+        int len = snprintf(line, sizeof(line), "Z-axis(%s): %s mT Force(%s): %s N", dev.label, z_str, dev.label, force_str);
+        bench_cycles[BENCH_FORMAT][i] = bench_elapsed(t);
+        if (len >= (int)sizeof(line)) len = sizeof(line) - 1;
+        
+        // Same length, but nothing a host parser would take for a reading
+        memset(line, '-', len);
+        memcpy(line, "bench ", 6);
+        t = bench_now();
+        printf("%s\n", line);
+        fflush(stdout);
+        bench_cycles[BENCH_USB][i] = bench_elapsed(t);
+    }
+    (void)sink;
+}
+
+#endif
+
+// ========================================
+// COMMANDS
+// ========================================
+// Line based, one command per line, read without blocking from the main
+// loop. Replies are text lines starting with "OK" or "ERR". A command
+// that needs core1 posts its request and replies later (command_defer()).
+
+void cmd_help(char *args);
+
+/**
+ * Finish the current command from the main loop, see command_wait_t.
+ */
+void command_defer(bool (*busy)(void), void (*finish)(bool done), uint32_t timeout_us) {
+    cmd_wait.busy = busy;
+    cmd_wait.finish = finish;
+    cmd_wait.deadline = make_timeout_time_us(timeout_us);
+    cmd_wait.active = true;
+}
+
+/**
+ * Reply to a deferred command once core1 is done. True while it still waits.
+ */
+bool command_wait_poll() {
+    if (!cmd_wait.active) return false;
+    bool busy = cmd_wait.busy();
+    if (busy && !time_reached(cmd_wait.deadline)) return true;
+    cmd_wait.active = false;
+    output_flush();
+    cmd_wait.finish(!busy);
+    return false;
+}
+
+/**
+ * dump [max]: send buffered raw samples (oldest first) as
+ * FRAME_TYPE_HISTORY frames and remove them from the history.
+ * Replies "OK dump <count> <lost>" before the frames, where lost is the
+ * number of samples overwritten since the previous dump.
+ */
+void cmd_dump(char *args) {
+    uint32_t count = sample_ring_count(&history);
+    if (*args) {
+        uint32_t max = strtoul(args, NULL, 10);
+        if (max < count) count = max;
+    }
+    
+    printf("OK dump %lu %lu\n", (unsigned long)count, (unsigned long)history.dropped);
+    history.dropped = 0;
+    
+    mlx_sample_t sample;
+    for (uint32_t i = 0; i < count && sample_ring_pop(&history, &sample); i++) {
+        output_sample_frame(&sample, FRAME_TYPE_HISTORY);
+    }
+    output_flush();
+}
+
+// Axis mask <-> "txyz" style names for the sensor command
+const char mlx_axis_names[] = "txyz";
+
+uint8_t parse_axes(const char *str) {
+    uint8_t axes = 0;
+    for (; *str; str++) {
+        const char *name = strchr(mlx_axis_names, *str);
+        if (!name) return 0;
+        axes |= (uint8_t)(1u << (name - mlx_axis_names));
+    }
+    return axes;
+}
+
+void print_sensor_config(const mlx_dev_t *dev) {
+    char axes[sizeof(mlx_axis_names)];
+    size_t n = 0;
+    for (size_t i = 0; i < sizeof(mlx_axis_names) - 1; i++) {
+        if (dev->cfg.axes & (1u << i)) axes[n++] = mlx_axis_names[i];
+    }
+    axes[n] = '\0';
+    
+    printf("OK sensor %s axes %s gain %d res %d osr %d osr2 %d dig_filt %d auto %s temp %u conv %luus",
+           dev->label, axes, dev->cfg.gain, dev->cfg.res, dev->cfg.osr, dev->cfg.osr2, dev->cfg.dig_filt,
+           dev->auto_range ? "on" : "off", dev->temp_every, (unsigned long)mlx_conversion_time_us(dev, dev->cfg.axes));
+    if (dev->has_temp) printf(" %.2fC", dev->temp_c);
+    printf("\n");
+}
+
+bool sensor_cfg_busy() {
+    return mlx_devices[cmd_wait.sensor].cfg_pending;
+}
+
+void cmd_sensor_done(bool done) {
+    mlx_dev_t *dev = &mlx_devices[cmd_wait.sensor];
+    if (!done) {
+        printf("ERR sensor %s busy\n", dev->label);
+        return;
+    }
+    if (dev->cfg_result != MLX_OK) {
+        printf("ERR sensor %s register write failed (%d)\n", dev->label, dev->cfg_result);
+        return;
+    }
+    if (cmd_wait.auto_range >= 0) dev->auto_range = cmd_wait.auto_range;
+    if (cmd_wait.temp_every >= 0) dev->temp_every = (uint8_t)cmd_wait.temp_every;
+    print_sensor_config(dev);
+}
+
+/**
+ * sensor [n [key value]...]: show or change sensor n (1 = M1). Keys are
+ * axes (any of t/x/y/z, z required, e.g. "z" or "txyz"), gain 0-7, res 0-3,
+ * osr 0-3, osr2 0-3, dig_filt 0-7, auto on|off and temp <n>|off (add T to
+ * every nth single measurement). Register changes are handed to core1 and
+ * applied between reads; the reply follows once they are written.
+ */
+void cmd_sensor(char *args) {
+    char *tok = strtok(args, " ");
+    if (!tok) {
+        for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+            print_sensor_config(&mlx_devices[i]);
+        }
+        return;
+    }
+    
+    unsigned long n = strtoul(tok, NULL, 10);
+    if (n < 1 || n > MLX_SENSOR_COUNT) {
+        printf("ERR no sensor '%s'\n", tok);
+        return;
+    }
+    mlx_dev_t *dev = &mlx_devices[n - 1];
+    
+    mlx_config_t cfg = dev->cfg;
+    int auto_range = -1;
+    int temp_every = -1;
+    while ((tok = strtok(NULL, " "))) {
+        char *val = strtok(NULL, " ");
+        if (!val) {
+            printf("ERR missing value for '%s'\n", tok);
+            return;
+        }
+        long v = strtol(val, NULL, 10);
+        if (strcmp(tok, "axes") == 0 && (parse_axes(val) & MLX90393_AXIS_Z)) {
+            cfg.axes = parse_axes(val);
+        } else if (strcmp(tok, "gain") == 0 && v >= 0 && v <= MLX90393_GAIN_1X) {
+            cfg.gain = (mlx90393_gain_t)v;
+        } else if (strcmp(tok, "res") == 0 && v >= 0 && v <= MLX90393_RES_19) {
+            cfg.res = (mlx90393_resolution_t)v;
+        } else if (strcmp(tok, "osr") == 0 && v >= 0 && v <= MLX90393_OSR_3) {
+            cfg.osr = (mlx90393_osr_t)v;
+        } else if (strcmp(tok, "osr2") == 0 && v >= 0 && v <= MLX90393_OSR_3) {
+            cfg.osr2 = (mlx90393_osr_t)v;
+        } else if (strcmp(tok, "dig_filt") == 0 && v >= 0 && v <= MLX90393_FILTER_7) {
+            cfg.dig_filt = (mlx90393_filter_t)v;
+        } else if (strcmp(tok, "auto") == 0 && (strcmp(val, "on") == 0 || strcmp(val, "off") == 0)) {
+            auto_range = (strcmp(val, "on") == 0);
+        } else if (strcmp(tok, "temp") == 0 && (strcmp(val, "off") == 0 || (v >= 1 && v <= UINT8_MAX))) {
+            temp_every = (strcmp(val, "off") == 0) ? 0 : (int)v;
+        } else {
+            printf("ERR bad setting '%s %s'\n", tok, val);
+            return;
+        }
+    }
+    
+#if FIXED_SENSOR_CONFIG
+    if (cfg.gain != dev->cfg.gain || cfg.res != dev->cfg.res || auto_range == 1) {
+        printf("ERR gain and resolution are fixed in this build\n");
+        return;
+    }
+#endif
+    
+    if (!dev->initialized) {
+        printf("ERR sensor %s not initialized\n", dev->label);
+        return;
+    }
+    
+    if (memcmp(&cfg, &dev->cfg, sizeof(cfg)) != 0) {
+        if (dev->cfg_pending) {
+            printf("ERR sensor %s busy\n", dev->label);
+            return;
+        }
+        cmd_wait.sensor = n - 1;
+        cmd_wait.auto_range = auto_range;
+        cmd_wait.temp_every = temp_every;
+        dev->cfg_request = cfg;
+        __dmb();  // Request before the flag
+        dev->cfg_pending = true;
+        command_defer(sensor_cfg_busy, cmd_sensor_done, acq_period_us + 100000);
+        return;
+    }
+    if (auto_range >= 0) dev->auto_range = auto_range;
+    if (temp_every >= 0) dev->temp_every = (uint8_t)temp_every;
+    print_sensor_config(dev);
+}
+
+void print_cal_model(const char *label, const char *what, const cal_model_t *model) {
+    printf("OK cal %s %s ", label, what);
+    if (model->type == CAL_MODEL_PWL) {
+        printf("pwl knots %u", model->count);
+    } else if (model->count == 2) {
+        printf("linear slope %.6f intercept %.6f", model->coeffs[1], model->coeffs[0]);
+    } else {
+        printf("poly order %u", model->count - 1);
+    }
+    printf(" span %.3f..%.3f mT r2 %.4f\n", model->z_min, model->z_max, model->r_squared);
+}
+
+void print_cal(size_t index) {
+    const mlx_dev_t *dev = &mlx_devices[index];
+    bool stored = cal_store.sensors[index].flags & CAL_VALID;
+    print_cal_model(dev->label, "model", &dev->cal);
+    printf("OK cal %s temp %.5f mT/C ref %.2f C\n", dev->label, dev->cal.temp_coeff, dev->cal.temp_ref_c);
+    printf("OK cal %s source %s points %u\n", dev->label, stored ? "flash" : "default", cal_sessions[index].count);
+}
+
+void print_cal_temp(const mlx_dev_t *dev, const cal_session_t *session) {
+    printf("OK cal %s temp fit %.5f mT/C ref %.2f C span %.2f C samples %lu\n", dev->label,
+           session->temp_coeff, session->temp_ref_c, session->temp_max_c - session->temp_min_c,
+           (unsigned long)session->temp_n);
+}
+
+/**
+ * cal <n> <command>: on-device calibration of sensor n.
+ *   add <kg>        average the next CAL_SAMPLES_PER_POINT readings with that weight on
+ *   point <mT> <N>  record a point measured elsewhere (host upload)
+ *   fit [linear|pwl]  least-squares line, or piecewise-linear through the points
+ *   poly <z_min> <z_max> <c0> <c1> ...  polynomial from the host, c0 + c1*z + ...
+ *   temp start|stop  fit Z drift against temperature while the rig warms at a constant load
+ *   temp <mT/C> <ref C>  set the drift correction directly (0 0 turns it off)
+ *   commit          use the last fit/poly and temp fit (either may be missing) and save to flash
+ *   show            active model and where it came from
+ *   clear           drop the recorded points
+ */
+void cmd_cal(char *args) {
+    char *tok = strtok(args, " ");
+    char *sub = strtok(NULL, " ");
+    unsigned long n = tok ? strtoul(tok, NULL, 10) : 0;
+    if (n < 1 || n > MLX_SENSOR_COUNT || !sub) {
+        printf("ERR usage: cal <n> add <kg>|point <mT> <N>|fit [linear|pwl]|poly ...|temp ...|commit|show|clear\n");
+        return;
+    }
+    size_t index = n - 1;
+    mlx_dev_t *dev = &mlx_devices[index];
+    cal_session_t *session = &cal_sessions[index];
+    
+#if FIXED_PROCESSING
+    if (strcmp(sub, "show") != 0) {
+        printf("ERR calibration is fixed in this build (FORCE_SENSOR_RUNTIME_CAL)\n");
+        return;
+    }
+#endif
+    if (strcmp(sub, "add") == 0 || strcmp(sub, "point") == 0) {
+        char *a = strtok(NULL, " ");
+        char *b = strtok(NULL, " ");
+        bool add = (strcmp(sub, "add") == 0);
+        if (!a || (!add && !b)) {
+            printf("ERR usage: cal <n> add <kg> | cal <n> point <mT> <N>\n");
+        } else if (session->collect_remaining > 0) {
+            printf("ERR cal %s already collecting\n", dev->label);
+        } else if (session->count >= CAL_MAX_POINTS) {
+            printf("ERR cal %s has %d points, clear first\n", dev->label, CAL_MAX_POINTS);
+        } else if (!add) {
+            cal_point_t *point = &session->points[session->count++];
+            point->z_mT = strtof(a, NULL);
+            point->force_n = strtof(b, NULL);
+            printf("OK cal %s point %u %.3f N %.3f mT\n", dev->label, session->count, point->force_n, point->z_mT);
+        } else if (!dev->initialized) {
+            printf("ERR sensor %s not initialized\n", dev->label);
+        } else {
+            session->collect_force_n = strtof(a, NULL) * KG_TO_NEWTONS;
+            session->collect_sum = 0;
+            session->collect_n = 0;
+            session->collect_remaining = CAL_SAMPLES_PER_POINT;
+            printf("OK cal %s collecting %d samples\n", dev->label, CAL_SAMPLES_PER_POINT);
+        }
+    } else if (strcmp(sub, "fit") == 0) {
+        char *kind = strtok(NULL, " ");
+        if (kind && strcmp(kind, "pwl") == 0) {
+            session->fit_valid = cal_fit_pwl(session, &session->fit);
+        } else if (!kind || strcmp(kind, "linear") == 0) {
+            session->fit_valid = cal_fit_linear(session, &session->fit);
+        } else {
+            printf("ERR unknown model '%s'\n", kind);
+            return;
+        }
+        if (session->fit_valid) {
+            print_cal_model(dev->label, "fit", &session->fit);
+        } else {
+            printf("ERR cal %s needs 2+ points at different readings\n", dev->label);
+        }
+    } else if (strcmp(sub, "poly") == 0) {
+        cal_model_t *fit = &session->fit;
+        memset(fit, 0, sizeof(*fit));
+        char *z_min = strtok(NULL, " ");
+        char *z_max = strtok(NULL, " ");
+        while ((tok = strtok(NULL, " ")) && fit->count < CAL_POLY_MAX_COEFFS) {
+            fit->coeffs[fit->count++] = strtof(tok, NULL);
+        }
+        fit->type = CAL_MODEL_POLY;
+        fit->z_min = z_min ? strtof(z_min, NULL) : 0.0f;
+        fit->z_max = z_max ? strtof(z_max, NULL) : 0.0f;
+        session->fit_valid = fit->count >= 1 && !tok && fit->z_max > fit->z_min;
+        if (!session->fit_valid) {
+            printf("ERR usage: cal <n> poly <z_min> <z_max> <c0> [c1 .. c%d]\n", CAL_POLY_MAX_COEFFS - 1);
+            return;
+        }
+        fit->r_squared = cal_r_squared(session, fit);
+        fit->flags = CAL_VALID;
+        print_cal_model(dev->label, "fit", fit);
+    } else if (strcmp(sub, "temp") == 0) {
+        char *a = strtok(NULL, " ");
+        char *b = strtok(NULL, " ");
+        if (a && strcmp(a, "start") == 0) {
+            if (!dev->temp_every && !(dev->cfg.axes & MLX90393_AXIS_T)) {
+                printf("ERR sensor %s does not measure temperature, set sensor %lu temp <n>\n", dev->label, n);
+                return;
+            }
+            session->temp_n = 0;
+            session->temp_sum_t = session->temp_sum_z = session->temp_sum_tt = session->temp_sum_tz = 0;
+            session->temp_collecting = true;
+            printf("OK cal %s temp collecting, keep the load constant\n", dev->label);
+        } else if (a && strcmp(a, "stop") == 0) {
+            if (!session->temp_collecting) {
+                printf("ERR cal %s no temp run, use cal %lu temp start\n", dev->label, n);
+            } else if (cal_fit_temp(session)) {
+                print_cal_temp(dev, session);
+            } else {
+                printf("ERR cal %s temperature moved %.2f C, needs %.1f C\n", dev->label,
+                       session->temp_n ? session->temp_max_c - session->temp_min_c : 0.0f, CAL_TEMP_MIN_SPAN_C);
+            }
+        } else if (a && b) {
+            session->temp_collecting = false;
+            session->temp_n = 0;
+            session->temp_min_c = session->temp_max_c = 0;
+            session->temp_coeff = strtof(a, NULL);
+            session->temp_ref_c = strtof(b, NULL);
+            session->temp_valid = true;
+            print_cal_temp(dev, session);
+        } else {
+            printf("ERR usage: cal <n> temp start|stop|<mT/C> <ref C>\n");
+        }
+    } else if (strcmp(sub, "commit") == 0) {
+        if (!session->fit_valid && !session->temp_valid) {
+            printf("ERR cal %s nothing to commit, run fit first\n", dev->label);
+            return;
+        }
+        // A new force fit keeps the drift correction in use unless a temp fit replaces it
+        cal_model_t model = session->fit_valid ? session->fit : dev->cal;
+        model.temp_coeff = session->temp_valid ? session->temp_coeff : dev->cal.temp_coeff;
+        model.temp_ref_c = session->temp_valid ? session->temp_ref_c : dev->cal.temp_ref_c;
+        model.flags = CAL_VALID;
+        cal_store.sensors[index] = model;
+        dev->cal = model;
+        cal_build_lut(dev);
+        if (cal_store_save()) {
+            print_cal(index);
+        } else {
+            printf("ERR cal %s flash write failed (active until reboot)\n", dev->label);
+        }
+    } else if (strcmp(sub, "show") == 0) {
+        print_cal(index);
+    } else if (strcmp(sub, "clear") == 0) {
+        memset(session, 0, sizeof(*session));
+        printf("OK cal %s cleared\n", dev->label);
+    } else {
+        printf("ERR unknown cal command '%s'\n", sub);
+    }
+}
+
+void print_tare(const mlx_dev_t *dev, const char *note) {
+    char offset_str[16];
+    char zero_str[16];
+    format_value(offset_str, sizeof(offset_str), dev->z_offset);
+    format_value(zero_str, sizeof(zero_str), dev->cal_zero_z);
+    printf("OK tare %s offset %s mT zero %s mT track %s%s\n", dev->label, offset_str, zero_str,
+           dev->tare_track ? "on" : "off", note);
+}
+
+/**
+ * tare <n> [track on|off | reset | show]: with sensor n unloaded, average
+ * the next TARE_SAMPLES readings and shift its zero offset so they read
+ * 0 N. The offset and the tracking setting are saved to flash with the
+ * calibration.
+ *   track on|off    follow slow baseline drift while unloaded and quiet
+ *   reset           back to Z_OFFSET_MT
+ */
+void cmd_tare(char *args) {
+    char *tok = strtok(args, " ");
+    char *sub = strtok(NULL, " ");
+    char *val = strtok(NULL, " ");
+    unsigned long n = tok ? strtoul(tok, NULL, 10) : 0;
+    if (n < 1 || n > MLX_SENSOR_COUNT) {
+        printf("ERR usage: tare <n> [track on|off | reset | show]\n");
+        return;
+    }
+    mlx_dev_t *dev = &mlx_devices[n - 1];
+    
+#if FIXED_PROCESSING
+    if (!sub || strcmp(sub, "show") != 0) {
+        printf("ERR zero offset is fixed in this build (FORCE_SENSOR_RUNTIME_CAL)\n");
+        return;
+    }
+#endif
+    if (!sub) {
+        if (!dev->initialized) {
+            printf("ERR sensor %s not initialized\n", dev->label);
+        } else if (dev->tare_remaining > 0) {
+            printf("ERR tare %s already collecting\n", dev->label);
+        } else {
+            dev->tare_sum = 0;
+            dev->tare_n = 0;
+            dev->tare_remaining = TARE_SAMPLES;
+            printf("OK tare %s collecting %d samples\n", dev->label, TARE_SAMPLES);
+        }
+        return;
+    }
     
-    // Main loop
-    while (true) {
-        // Toggle LED
-        gpio_put(LED_PIN, led_state);
-        led_state = !led_state;
+    if (strcmp(sub, "show") == 0) {
+        print_tare(dev, "");
+        return;
+    } else if (strcmp(sub, "track") == 0 && val && (strcmp(val, "on") == 0 || strcmp(val, "off") == 0)) {
+        dev->tare_track = (strcmp(val, "on") == 0);
+        dev->track_primed = false;
+    } else if (strcmp(sub, "reset") == 0) {
+        dev->z_offset = VALUE_FROM_FLOAT(Z_OFFSET_MT);
+        dev->track_primed = false;
+    } else {
+        printf("ERR usage: tare <n> [track on|off | reset | show]\n");
+        return;
+    }
+    print_tare(dev, cal_store_save() ? "" : " (flash write failed, active until reboot)");
+}
+
+void print_filter(const mlx_dev_t *dev) {
+    const filter_config_t *f = &dev->filter;
+    const char *biquad = (f->biquad == BIQUAD_LOWPASS) ? "lowpass" : (f->biquad == BIQUAD_NOTCH) ? "notch" : "off";
+    printf("OK filter %s median %u %s", dev->label, f->median_len, biquad);
+    if (f->biquad != BIQUAD_OFF) printf(" %.2f q %.3f", f->biquad_hz, f->biquad_q);
+    printf(" mean %u ema %.3f rate %.1fHz\n", f->mean_len, f->ema, filter_rate_hz(dev));
+}
+
+/**
+ * filter [n [stage args]...]: show or change sensor n's filter chain.
+ * Stages: median <0|3|5|7>, lowpass <hz> [q], notch <hz> [q], biquad off,
+ * mean <0-FILTER_MEAN_MAX>, ema <0-0.99>. The chain restarts from the next
+ * sample.
+ */
+void cmd_filter(char *args) {
+    char *tok = strtok(args, " ");
+    if (!tok) {
+        for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+            print_filter(&mlx_devices[i]);
+        }
+        return;
+    }
+    
+    unsigned long n = strtoul(tok, NULL, 10);
+    if (n < 1 || n > MLX_SENSOR_COUNT) {
+        printf("ERR no sensor '%s'\n", tok);
+        return;
+    }
+    mlx_dev_t *dev = &mlx_devices[n - 1];
+    
+    filter_config_t cfg = dev->filter;
+    tok = strtok(NULL, " ");
+#if FIXED_PROCESSING
+    if (tok) {
+        printf("ERR filter is fixed in this build (FORCE_SENSOR_RUNTIME_CAL)\n");
+        return;
+    }
+#endif
+    while (tok) {
+        char *val = strtok(NULL, " ");
+        if (!val) {
+            printf("ERR missing value for '%s'\n", tok);
+            return;
+        }
+        float v = strtof(val, NULL);
+        char *next = strtok(NULL, " ");
         
-        // Read MLX90393 Z-axis
-        if (mlx_initialized) {
-            float z;
-            if (mlx_read_data(&z)) {
-                if (first_mag_reading) {
-                    smoothed_z = z;
-                    first_mag_reading = false;
-                } else {
-                    smoothed_z = smooth(z, FILTER_VAL, smoothed_z);
-                }
-                
-                // Output Z-axis value only (force calculation done in Python)
-                printf("Z-axis(M1): %.3f mT\n", smoothed_z);
+        if (strcmp(tok, "median") == 0 && v >= 0 && v <= FILTER_MEDIAN_MAX && ((int)v == 0 || ((int)v & 1))) {
+            cfg.median_len = (uint8_t)v;
+        } else if (strcmp(tok, "mean") == 0 && v >= 0 && v <= FILTER_MEAN_MAX) {
+            cfg.mean_len = (uint8_t)v;
+        } else if (strcmp(tok, "ema") == 0 && v >= 0 && v < 1) {
+            cfg.ema = v;
+        } else if (strcmp(tok, "biquad") == 0 && strcmp(val, "off") == 0) {
+            cfg.biquad = BIQUAD_OFF;
+        } else if ((strcmp(tok, "lowpass") == 0 || strcmp(tok, "notch") == 0) && v > 0) {
+            cfg.biquad = (tok[0] == 'l') ? BIQUAD_LOWPASS : BIQUAD_NOTCH;
+            cfg.biquad_hz = v;
+            cfg.biquad_q = (cfg.biquad == BIQUAD_LOWPASS) ? FILTER_Q_DEFAULT : FILTER_NOTCH_Q_DEFAULT;
+            // Optional Q: a number where the next stage name would be
+            if (next && (next[0] == '.' || (next[0] >= '0' && next[0] <= '9'))) {
+                cfg.biquad_q = strtof(next, NULL);
+                next = strtok(NULL, " ");
+            }
+        } else {
+            printf("ERR bad filter setting '%s %s'\n", tok, val);
+            return;
+        }
+        tok = next;
+    }
+    
+    if (cfg.biquad != BIQUAD_OFF) {
+        biquad_t check;
+        if (!biquad_design(&check, cfg.biquad, cfg.biquad_hz, cfg.biquad_q, filter_rate_hz(dev))) {
+            printf("ERR biquad %.2fHz q %.3f not possible at %.1fHz\n", cfg.biquad_hz, cfg.biquad_q, filter_rate_hz(dev));
+            return;
+        }
+    }
+    dev->filter = cfg;
+    dev->has_reading = false;   // Restart the chain on the next sample
+    print_filter(dev);
+}
+
+/**
+ * jitter [reset]: sample interval statistics per sensor, see jitter_stats_t.
+ */
+void cmd_jitter(char *args) {
+    bool reset = (strcmp(args, "reset") == 0);
+    for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+        mlx_dev_t *dev = &mlx_devices[i];
+        jitter_stats_t j = dev->jitter;  // Core1 may be updating it, good enough for stats
+        uint32_t nominal = acq_nominal_period_us(dev);
+        
+        if (reset) {
+            dev->jitter_reset = true;
+            continue;
+        }
+        printf("OK jitter %s n %lu min %lu max %lu mean %.1f nominal %lu missed %lu\n", dev->label,
+               (unsigned long)j.count, (unsigned long)j.min_us, (unsigned long)j.max_us,
+               j.count ? (double)j.sum_us / j.count : 0.0, (unsigned long)nominal, (unsigned long)acq_ticks_missed);
+        printf("OK jitter %s hist %d %ld", dev->label, JITTER_BIN_US,
+               (long)nominal - (JITTER_BINS / 2) * JITTER_BIN_US);
+        for (int b = 0; b < JITTER_BINS; b++) {
+            printf(" %lu", (unsigned long)j.hist[b]);
+        }
+        printf("\n");
+    }
+    if (reset) printf("OK jitter reset\n");
+}
+
+bool acq_timing_busy() {
+    return acq_timing_pending;
+}
+
+/**
+ * Hand a mode/rate change to core1 for a command, which replies from
+ * finish() once it has taken effect. False if another change is pending.
+ */
+bool acq_request_timing(acq_mode_t mode, uint32_t period_us, void (*finish)(bool done)) {
+    if (acq_timing_pending) return false;
+    mode = power_wake_mode(mode);
+    acq_mode_request = mode;
+    acq_period_request = period_us;
+    __dmb();  // Request before the flag
+    acq_timing_pending = true;
+#if FORCE_SENSOR_HOST
+    host_apply_timing();
+#endif
+    command_defer(acq_timing_busy, finish, acq_period_us + 100000);
+    return true;
+}
+
+/**
+ * Slowest conversion over all sensors, the shortest single mode period.
+ */
+uint32_t acq_min_period_us() {
+    uint32_t t = 0;
+    for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+        mlx_dev_t *dev = &mlx_devices[i];
+        uint32_t conv_us = mlx_conversion_time_us(dev, dev->cfg.axes);
+        if (dev->initialized && conv_us > t) t = conv_us;
+    }
+    return t;
+}
+
+void print_rate() {
+    printf("OK rate %.2f Hz period %lu us mode %s\n", 1e6 / acq_period_us, (unsigned long)acq_period_us,
+           (acq_mode == ACQ_MODE_BURST) ? "burst" : (acq_mode == ACQ_MODE_WOC) ? "woc" : "single");
+}
+
+void cmd_rate_done(bool done) {
+    if (!done) {
+        printf("ERR rate busy\n");
+        return;
+    }
+    print_rate();
+}
+
+/**
+ * rate [hz]: single mode sample rate. The timer restarts at the new period
+ * straight away; in burst mode the conversion time sets the rate, and the
+ * new period applies once back in single mode.
+ */
+void cmd_rate(char *args) {
+    if (*args) {
+        float hz = strtof(args, NULL);
+        uint32_t period_us = (hz > 0) ? (uint32_t)(1e6f / hz + 0.5f) : 0;
+        uint32_t min_us = acq_min_period_us();
+        if (period_us < min_us || period_us > SAMPLE_PERIOD_MAX_US) {
+            printf("ERR rate must be %.2f-%.1f Hz at the current sensor settings\n",
+                   1e6 / SAMPLE_PERIOD_MAX_US, min_us ? 1e6 / min_us : 0.0);
+            return;
+        }
+        if (!acq_request_timing(acq_mode, period_us, cmd_rate_done)) printf("ERR rate busy\n");
+        return;
+    }
+    print_rate();
+}
+
+void cmd_mode_done(bool done) {
+    if (!done) {
+        printf("ERR mode busy\n");
+    } else if (acq_mode != cmd_wait.mode) {
+        printf("ERR burst mode failed, check DRDY wiring\n");
+    } else {
+        print_rate();
+    }
+}
+
+/**
+ * mode [single|burst]: acquisition mode. Burst needs every sensor's DRDY
+ * pin wired; if one cannot start, all stay in single mode.
+ */
+void cmd_mode(char *args) {
+    if (*args) {
+        acq_mode_t mode;
+        if (strcmp(args, "single") == 0) {
+            mode = ACQ_MODE_SINGLE;
+        } else if (strcmp(args, "burst") == 0) {
+            mode = ACQ_MODE_BURST;
+        } else {
+            printf("ERR usage: mode single|burst\n");
+            return;
+        }
+        cmd_wait.mode = mode;
+        if (!acq_request_timing(mode, acq_period_us, cmd_mode_done)) printf("ERR mode busy\n");
+        return;
+    }
+    print_rate();
+}
+
+void print_power() {
+    printf("OK power %s idle %lu ms wake %.3f mT state %s\n", power.adaptive ? "adaptive" : "off",
+           (unsigned long)power.idle_ms, power.wake_mT, power.idle ? "idle" : "active");
+}
+
+void cmd_power_done(bool done) {
+    if (!done) {
+        printf("ERR power busy\n");
+        return;
+    }
+    print_power();
+}
+
+/**
+ * power [adaptive|off] [idle <ms>] [wake <mT>]: adaptive power. Once no
+ * sensor has moved for idle ms they sit in wake-on-change, woken by a Z
+ * change of wake mT, and both cores sleep. The first change restores the
+ * previous mode and rate. The LED stays off meanwhile.
+ */
+void cmd_power(char *args) {
+    int adaptive = -1;
+    uint32_t idle_ms = power.idle_ms;
+    float wake_mT = power.wake_mT;
+    char *tok = strtok(args, " ");
+    while (tok) {
+        if (strcmp(tok, "adaptive") == 0 || strcmp(tok, "off") == 0) {
+            adaptive = (strcmp(tok, "adaptive") == 0);
+        } else {
+            char *val = strtok(NULL, " ");
+            if (!val) {
+                printf("ERR missing value for '%s'\n", tok);
+                return;
+            }
+            if (strcmp(tok, "idle") == 0 && strtoul(val, NULL, 10) >= 100) {
+                idle_ms = strtoul(val, NULL, 10);
+            } else if (strcmp(tok, "wake") == 0 && strtof(val, NULL) > 0) {
+                wake_mT = strtof(val, NULL);
             } else {
-                printf("Z-axis(M1): ERROR\n");
+                printf("ERR bad setting '%s %s'\n", tok, val);
+                return;
+            }
+        }
+        tok = strtok(NULL, " ");
+    }
+    
+    power.idle_ms = idle_ms;
+    power.wake_mT = wake_mT;
+    if (adaptive == 1 && !power.adaptive) {
+        power.idle = false;
+        power.active_us = time_us_64();
+        power.adaptive = true;
+        gpio_put(LED_PIN, 0);
+    } else if (adaptive == 0 && power.adaptive) {
+        power.adaptive = false;
+        if (power.idle) {
+            if (!acq_request_timing(power.active_mode, power.active_period_us, cmd_power_done)) printf("ERR power busy\n");
+            return;
+        }
+    }
+    print_power();
+}
+
+/**
+ * format [text|binary]: output format of the sample stream. Text output
+ * resumes with freshly primed filters.
+ */
+void cmd_format(char *args) {
+    if (strcmp(args, "text") == 0) {
+        if (output_format != OUTPUT_FORMAT_TEXT) {
+            for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) mlx_devices[i].has_reading = false;
+        }
+        output_format = OUTPUT_FORMAT_TEXT;
+    } else if (strcmp(args, "binary") == 0) {
+        output_format = OUTPUT_FORMAT_BINARY;
+    } else if (*args) {
+        printf("ERR usage: format text|binary\n");
+        return;
+    }
+    printf("OK format %s\n", (output_format == OUTPUT_FORMAT_BINARY) ? "binary" : "text");
+}
+
+/**
+ * stream [start|stop]: pause or resume the sample stream. Acquisition,
+ * filtering, calibration and the dump history keep running while stopped.
+ */
+void cmd_stream(char *args) {
+    if (strcmp(args, "start") == 0) {
+        output_streaming = true;
+    } else if (strcmp(args, "stop") == 0) {
+        output_streaming = false;
+    } else if (*args) {
+        printf("ERR usage: stream start|stop\n");
+        return;
+    }
+    printf("OK stream %s\n", output_streaming ? "on" : "off");
+}
+
+void print_trigger() {
+    static const char *const mode_names[] = {"off", "force", "dzdt"};
+    char level[16];
+    format_value(level, sizeof(level), trigger.level);
+    printf("OK trigger %s %s sensor %s pre %u post %u idle %.1fHz events %lu%s\n", mode_names[trigger.mode], level,
+           mlx_devices[trigger.sensor].label, trigger.pre, trigger.post, 1e6 / trigger.idle_us,
+           (unsigned long)trigger.events, trigger.capturing ? " capturing" : "");
+}
+
+void cmd_trigger_done(bool done) {
+    if (!done) {
+        printf("ERR trigger busy\n");
+        return;
+    }
+    trigger = cmd_wait.trigger;
+    trigger_rearm();
+    print_trigger();
+}
+
+/**
+ * trigger [off | force <N> | dzdt <mT/s>] [key value]...: event capture,
+ * keys pre <n>, post <n>, sensor <n>, idle <hz>. Arming switches single
+ * mode to the fastest rate the sensors allow; "off" restores the old rate.
+ */
+void cmd_trigger(char *args) {
+    trigger_t t = trigger;
+    
+    char *key = strtok(args, " ");
+    while (key) {
+        if (strcmp(key, "off") == 0) {
+            t.mode = TRIGGER_OFF;
+            key = strtok(NULL, " ");
+            continue;
+        }
+        char *val = strtok(NULL, " ");
+        if (!val) {
+            printf("ERR trigger %s needs a value\n", key);
+            return;
+        }
+        float f = strtof(val, NULL);
+        if (strcmp(key, "force") == 0 || strcmp(key, "dzdt") == 0) {
+            t.mode = (key[0] == 'f') ? TRIGGER_FORCE : TRIGGER_DZDT;
+            t.level = VALUE_FROM_FLOAT(f);
+        } else if (strcmp(key, "pre") == 0) {
+            t.pre = (uint16_t)f;
+        } else if (strcmp(key, "post") == 0) {
+            t.post = (uint16_t)f;
+        } else if (strcmp(key, "sensor") == 0 && f >= 1 && f <= MLX_SENSOR_COUNT) {
+            t.sensor = (uint8_t)(f - 1);
+        } else if (strcmp(key, "idle") == 0 && f > 0) {
+            t.idle_us = (uint32_t)(1e6f / f);
+        } else {
+            printf("ERR trigger bad %s %s\n", key, val);
+            return;
+        }
+        key = strtok(NULL, " ");
+    }
+    if (t.post < 1 || t.pre + t.post > TRIGGER_WINDOW_MAX) {
+        printf("ERR trigger pre + post must be 1-%d with post >= 1\n", TRIGGER_WINDOW_MAX);
+        return;
+    }
+    
+    // Single mode runs flat out while armed
+    bool was_armed = (trigger.mode != TRIGGER_OFF);
+    acq_mode_t mode = acq_mode;
+    uint32_t period_us = 0;     // Rate to switch to first, 0 = none
+    if (t.mode != TRIGGER_OFF && !was_armed && acq_mode == ACQ_MODE_SINGLE) {
+        t.saved_period_us = acq_period_us;
+        mode = ACQ_MODE_SINGLE;
+        period_us = acq_min_period_us();
+    } else if (t.mode == TRIGGER_OFF && was_armed && t.saved_period_us != 0) {
+        period_us = t.saved_period_us;
+        t.saved_period_us = 0;
+    }
+    
+    cmd_wait.trigger = t;
+    if (period_us == 0) {
+        cmd_trigger_done(true);
+    } else if (!acq_request_timing(mode, period_us, cmd_trigger_done)) {
+        printf("ERR trigger busy\n");
+    }
+}
+
+/**
+ * batch [off | <samples> [<max_us>]]: USB output batching. "off" writes
+ * every sample as soon as it is processed (lowest latency).
+ */
+void cmd_batch(char *args) {
+    char *tok = strtok(args, " ");
+    if (tok && strcmp(tok, "off") == 0) {
+        out_batch_samples = 1;
+    } else if (tok) {
+        unsigned long samples = strtoul(tok, NULL, 10);
+        tok = strtok(NULL, " ");
+        unsigned long us = tok ? strtoul(tok, NULL, 10) : out_batch_us;
+        if (samples < 1 || samples > OUTPUT_BUF_SIZE / sizeof(sample_frame_t) || us > 1000000) {
+            printf("ERR usage: batch off | <1-%u> [<0-1000000 us>]\n", (unsigned)(OUTPUT_BUF_SIZE / sizeof(sample_frame_t)));
+            return;
+        }
+        out_batch_samples = samples;
+        out_batch_us = us;
+    }
+    printf("OK batch samples %lu us %lu\n", (unsigned long)out_batch_samples, (unsigned long)out_batch_us);
+}
+
+/**
+ * stats [reset]: hot-path counters. One line for the loops and output,
+ * then one per sensor with its failures broken down by cause and the
+ * supervisor's recoveries (time from the first failed measurement to back up).
+ */
+void cmd_stats(char *args) {
+    if (strcmp(args, "reset") == 0) {
+        loop_stats.core0_max_us = 0;
+        loop_stats.usb_dropped = 0;
+        stats_reset = true;
+        printf("OK stats reset\n");
+        return;
+    }
+    
+    printf("OK stats ring_drop %lu loop_overrun %lu core1_max_us %lu core0_max_us %lu usb_drop %lu watchdog_reboot %d\n",
+           (unsigned long)acq_ring.dropped, (unsigned long)acq_ticks_missed,
+           (unsigned long)loop_stats.core1_max_us, (unsigned long)loop_stats.core0_max_us,
+           (unsigned long)loop_stats.usb_dropped, watchdog_caused_reboot() ? 1 : 0);
+    for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+        mlx_dev_t *dev = &mlx_devices[i];
+        mlx_stats_t st = dev->stats;  // Core1 may be updating it, good enough for stats
+        printf("OK stats %s samples %lu nack %lu i2c_timeout %lu conv_timeout %lu status %lu "
+               "flag_error %lu flag_sed %lu flag_rs %lu overrun %lu up %d recoveries %lu recovery_fails %lu "
+               "recovery_last_ms %lu recovery_max_ms %lu bus_resets %lu drdy %d\n", dev->label,
+               (unsigned long)st.samples, (unsigned long)st.i2c_nack, (unsigned long)st.i2c_timeout,
+               (unsigned long)st.conv_timeout, (unsigned long)st.status_err, (unsigned long)st.flag_error,
+               (unsigned long)st.flag_sed, (unsigned long)st.flag_rs, (unsigned long)dev->overruns,
+               dev->initialized ? 1 : 0, (unsigned long)st.recoveries, (unsigned long)st.recovery_fails,
+               (unsigned long)st.recovery_last_ms, (unsigned long)st.recovery_max_ms, (unsigned long)st.bus_resets,
+               (dev->drdy_pin == MLX_NO_DRDY) ? 0 : dev->drdy_seen ? 1 : -1);
+    }
+}
+
+/**
+ * ping [token]: reply "OK pong <token> <time_us>" with the device clock at
+ * the time the command was handled, so the host can measure the command
+ * round trip and map sample timestamps onto its own clock.
+ */
+void cmd_ping(char *args) {
+    char *token = strtok(args, " ");
+    printf("OK pong %s %llu\n", token ? token : "0", (unsigned long long)time_us_64());
+}
+
+#if !FORCE_SENSOR_HOST
+bool bench_busy() {
+    return bench_request != 0;
+}
+
+void cmd_bench_done(bool done) {
+    size_t index = cmd_wait.sensor;
+    if (cmd_wait.sensor_stages && (!done || !bench_ok)) {
+        // Core1 finishes (or fails) the run on its own, don't report half of it
+        printf("ERR bench sensor %s failed\n", mlx_devices[index].label);
+        return;
+    }
+    
+    bench_core0(index, cmd_wait.iterations);
+    
+    float cycles_per_us = clock_get_hz(clk_sys) / 1e6f;
+    for (int stage = cmd_wait.sensor_stages ? 0 : BENCH_CORE1_STAGES; stage < BENCH_STAGES; stage++) {
+        bench_report((bench_stage_t)stage, cmd_wait.iterations, cycles_per_us);
+    }
+}
+
+/**
+ * bench [iterations] [n]: time every stage of the acquisition and output
+ * path on sensor n (default 1) and report min/avg/p99/max in us. Sampling
+ * pauses while the sensor stages run; the usb stage prints filler lines.
+ */
+void cmd_bench(char *args) {
+    char *tok = strtok(args, " ");
+    uint32_t iterations = tok ? strtoul(tok, NULL, 10) : BENCH_DEFAULT_ITER;
+    tok = strtok(NULL, " ");
+    unsigned long n = tok ? strtoul(tok, NULL, 10) : 1;
+    if (iterations < 1 || iterations > BENCH_MAX_ITER || n < 1 || n > MLX_SENSOR_COUNT) {
+        printf("ERR usage: bench [1-%d] [sensor]\n", BENCH_MAX_ITER);
+        return;
+    }
+    size_t index = n - 1;
+    
+    cmd_wait.sensor = index;
+    cmd_wait.iterations = iterations;
+    cmd_wait.sensor_stages = mlx_devices[index].initialized;
+    if (!cmd_wait.sensor_stages) {
+        cmd_bench_done(true);
+        return;
+    }
+    
+    bench_sensor = index;
+    __dmb();
+    bench_request = iterations;
+    uint32_t conv_us = mlx_conversion_time_us(&mlx_devices[index], mlx_devices[index].cfg.axes);
+    command_defer(bench_busy, cmd_bench_done, iterations * (2 * conv_us + 4 * I2C_TIMEOUT_US) + acq_period_us + 1000000);
+}
+#endif
+
+const command_t commands[] = {
+    {"help", cmd_help, "List commands"},
+    {"dump", cmd_dump, "dump [max] - send buffered raw samples as binary frames"},
+    {"cal", cmd_cal, "cal <n> add <kg>|point <mT> <N>|fit [linear|pwl]|poly <z_min> <z_max> <c0>..|temp ..|commit|show|clear"},
+    {"tare", cmd_tare, "tare <n> [track on|off | reset | show] - zero sensor n (unloaded), saved to flash"},
+#if !FORCE_SENSOR_HOST
+    {"bench", cmd_bench, "bench [iterations] [sensor] - time each acquisition/output stage (min/avg/p99/max)"},
+#endif
+    {"ping", cmd_ping, "ping [token] - echo the token with the device time in us"},
+    {"rate", cmd_rate, "rate [hz] - single mode sample rate"},
+    {"mode", cmd_mode, "mode [single|burst] - acquisition mode"},
+    {"format", cmd_format, "format [text|binary] - sample output format"},
+    {"stream", cmd_stream, "stream [start|stop] - pause/resume the sample stream"},
+    {"power", cmd_power, "power [adaptive|off] [idle <ms>] [wake <mT>] - wake-on-change and sleep while idle"},
+    {"trigger", cmd_trigger, "trigger [off | force <N> | dzdt <mT/s>] [pre n] [post n] [sensor n] [idle hz] - event capture"},
+    {"batch", cmd_batch, "batch [off | <samples> [<max_us>]] - USB output batching"},
+    {"stats", cmd_stats, "stats [reset] - sample, error, overrun and loop time counters"},
+    {"jitter", cmd_jitter, "jitter [reset] - sample interval min/max/mean and histogram"},
+    {"filter", cmd_filter, "filter [n [median <len>] [lowpass|notch <hz> [q]] [biquad off] [mean <len>] [ema <w>]] - show/set filter chain"},
+    {"sensor", cmd_sensor, "sensor [n [axes txyz] [gain|res|osr|osr2|dig_filt <v>] [auto on|off] [temp <n>|off]] - show/set sensor config"},
+};
+
+void cmd_help(char *args) {
+    (void)args;
+    for (size_t i = 0; i < count_of(commands); i++) {
+        printf("OK %s: %s\n", commands[i].name, commands[i].help);
+    }
+}
+
+void command_dispatch(char *line) {
+    char *args = line;
+    while (*args && *args != ' ') args++;
+    if (*args) *args++ = '\0';
+    while (*args == ' ') args++;
+    
+    for (size_t i = 0; i < count_of(commands); i++) {
+        if (strcmp(line, commands[i].name) == 0) {
+            commands[i].handler(args);
+            return;
+        }
+    }
+    printf("ERR unknown command '%s'\n", line);
+}
+
+/**
+ * Collect pending input characters and run complete lines. Never blocks;
+ * input stays queued while a deferred command waits for its reply.
+ */
+void command_poll() {
+    if (command_wait_poll()) return;
+    int c;
+    while ((c = getchar_timeout_us(0)) != PICO_ERROR_TIMEOUT) {
+        if (c == '\r' || c == '\n') {
+            if (cmd_len > 0) {
+                cmd_line[cmd_len] = '\0';
+                cmd_len = 0;
+                output_flush();
+                command_dispatch(cmd_line);
+                if (cmd_wait.active) return;
+            }
+        } else if (cmd_len < CMD_LINE_MAX - 1) {
+            cmd_line[cmd_len++] = (char)c;
+        }
+    }
+}
+
+// ========================================
+// MAIN
+// ========================================
+/**
+ * Core0 work on one acquired sample: conversion, tare/calibration hooks,
+ * trigger, filter chain and output. main() runs it on everything core1
+ * queues, the host replay build on recorded samples.
+ */
+void process_sample(const mlx_sample_t *sample) {
+    sample_ring_push_overwrite(&history, sample);
+    
+    uint32_t start_us = time_us_32();
+    mlx_dev_t *dev = &mlx_devices[sample->sensor];
+    value_t z = mlx_z_to_mT(dev, sample);
+#if FIXED_PROCESSING
+    // A fixed config has no temperature model, tare or calibration runs
+    power_feed(dev, z);
+#else
+    if (sample->t) {
+        float temp_c = mlx_temp_c(sample->t);
+        cal_feed_temp(sample->sensor, temp_c, z);
+        cal_set_temp(dev, temp_c);
+    }
+    z -= dev->temp_comp_mT;
+    tare_feed(dev, z);
+    power_feed(dev, z);
+    cal_feed(sample->sensor, z);
+#endif
+    
+    bool report = trigger_feed(dev, sample, z) && output_streaming;
+    
+    if (output_format == OUTPUT_FORMAT_BINARY) {
+        // Binary mode ships raw counts, the host does the conversion
+        if (report && output_ready()) output_sample_frame(sample, FRAME_TYPE_SAMPLE);
+    } else {
+        filter_track_rate(dev, sample->time_us);
+        if (!dev->has_reading) filter_reset(dev, z);
+        value_t z_filtered = filter_step(dev, z);
+        
+        // Z-axis first so existing "Z-axis(M1): X mT" parsers keep working
+        if (report && output_ready()) {
+            char z_str[16];
+            char force_str[16];
+            char line[64];
+            format_value(z_str, sizeof(z_str), z_filtered);
+            format_value(force_str, sizeof(force_str), calculate_force(dev, z_filtered));
+            int len = snprintf(line, sizeof(line), "Z-axis(%s): %s mT Force(%s): %s N" OUTPUT_EOL,
+                               dev->label, z_str, dev->label, force_str);
+            output_append(line, (len < (int)sizeof(line)) ? (size_t)len : sizeof(line) - 1);
+        }
+    }
+    
+    uint32_t took_us = time_us_32() - start_us;
+    if (took_us > loop_stats.core0_max_us) loop_stats.core0_max_us = took_us;
+}
+
+#if FORCE_SENSOR_HOST
+// ========================================
+// HOST REPLAY ENTRY POINTS
+// ========================================
+// Called by host/replay.c in place of main(): the same boot and per-sample
+// path, fed from a recording instead of core1. Output goes to stdout.
+
+void host_replay_boot() {
+#if !FIXED_PROCESSING
+    if (cal_store_load()) {
+        fprintf(stderr, "Calibration: loaded from the flash image\n");
+    }
+#endif
+    mlx_init_scales();
+    for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+        mlx_dev_t *dev = &mlx_devices[i];
+#if FIXED_SENSOR_CONFIG
+        dev->cfg.gain = FIXED_GAIN;
+        dev->cfg.res = FIXED_RES;
+        dev->auto_range = false;
+#endif
+        cal_build_lut(dev);
+        dev->initialized = true;    // Recorded samples stand in for the sensor
+        dev->up_reported = true;
+    }
+}
+
+size_t host_replay_sensor_count() {
+    return MLX_SENSOR_COUNT;
+}
+
+/**
+ * Start sensor n off at the recording's sample rate, as if it had been
+ * streaming for a while, so rate-dependent commands (biquad cutoffs) and
+ * the filter chain see the recorded rate from the first sample. The
+ * jitter statistics measure against the recorded period as well.
+ */
+void host_replay_sample_rate(uint8_t sensor, float hz) {
+    mlx_devices[sensor].sample_rate_hz = hz;
+    host_period_us[sensor] = (uint32_t)(1e6f / hz + 0.5f);
+}
+
+void host_replay_command(const char *text) {
+    char line[CMD_LINE_MAX];
+    snprintf(line, sizeof(line), "%s", text);
+    output_flush();
+    command_dispatch(line);
+    // Nothing here finishes a core1 request later, so reply (or time out) now
+    if (command_wait_poll()) {
+        cmd_wait.deadline = get_absolute_time();
+        command_wait_poll();
+    }
+}
+
+void host_replay_sample(uint8_t sensor, uint64_t time_us, uint16_t seq, int16_t z, uint8_t status, uint8_t range) {
+    mlx_sample_t sample = {
+        .time_us = time_us,
+        .seq = seq,
+        .z = z,
+        .status = status,
+        .sensor = sensor,
+        .range = range,
+    };
+    mlx_dev_t *dev = &mlx_devices[sensor];
+    host_time_us = time_us;
+    if (acq_timing_pending) host_apply_timing();    // Posted from the sample path
+    dev->stats.samples++;
+    acq_jitter_update(dev, time_us);
+    process_sample(&sample);
+    cal_store_poll();
+}
+
+void host_replay_finish() {
+    if (cal_store_dirty) cal_store_save();
+    output_flush();
+    fflush(stdout);
+}
+#else
+int main() {
+    // Initialize stdio
+    stdio_init_all();
+    
+    // Setup LED
+    gpio_init(LED_PIN);
+    gpio_set_dir(LED_PIN, GPIO_OUT);
+    
+    // Setup GPIO3 as VCC (optional - comment out if not needed)
+    gpio_init(GPIO3_VCC);
+    gpio_set_dir(GPIO3_VCC, GPIO_OUT);
+    gpio_put(GPIO3_VCC, 1);
+    
+    // Initialize the I2C buses that have sensors on them
+    for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+        for (size_t b = 0; b < MLX_BUS_COUNT; b++) {
+            if (mlx_buses[b].i2c == mlx_devices[i].i2c) {
+                mlx_devices[i].bus = (uint8_t)b;
+                mlx_buses[b].used = true;
             }
+        }
+    }
+    for (size_t b = 0; b < MLX_BUS_COUNT; b++) {
+        mlx_bus_t *bus = &mlx_buses[b];
+        if (!bus->used) continue;
+        i2c_init(bus->i2c, I2C_FREQ);
+        gpio_set_function(bus->sda_pin, GPIO_FUNC_I2C);
+        gpio_set_function(bus->scl_pin, GPIO_FUNC_I2C);
+        gpio_pull_up(bus->sda_pin);
+        gpio_pull_up(bus->scl_pin);
+    }
+    
+    printf("\n===========================================\n");
+    printf("  RASPBERRY PI PICO - FORCE SENSOR\n");
+    printf("===========================================\n");
+    printf("Sensor: MLX90393 Magnetometer x%u\n", (unsigned)MLX_SENSOR_COUNT);
+    for (size_t b = 0; b < MLX_BUS_COUNT; b++) {
+        if (mlx_buses[b].used) {
+            printf("I2C%u: SDA=GPIO%u, SCL=GPIO%u\n", (unsigned)b, mlx_buses[b].sda_pin, mlx_buses[b].scl_pin);
+        }
+    }
+    printf("Mode: RAW Z-AXIS OUTPUT\n");
+    printf("===========================================\n\n");
+    
+    sleep_ms(2000);
+    
+    if (watchdog_caused_reboot()) {
+        printf("WARNING: rebooted by the watchdog (acquisition stalled)\n");
+    }
+    
+#if FIXED_PROCESSING
+    printf("Calibration: fixed at build time\n");
+#else
+    if (cal_store_load()) {
+        printf("Calibration: loaded from flash\n");
+    } else {
+        printf("Calibration: compiled-in defaults\n");
+    }
+#endif
+#if FIXED_SENSOR_CONFIG
+    for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+        mlx_devices[i].cfg.gain = FIXED_GAIN;
+        mlx_devices[i].cfg.res = FIXED_RES;
+        mlx_devices[i].auto_range = false;
+    }
+#endif
+    
+    for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+        cal_build_lut(&mlx_devices[i]);
+    }
+    
+    // Initialize MLX90393s
+    mlx_init_scales();
+    for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+        mlx_dev_t *dev = &mlx_devices[i];
+        if (mlx_init(dev)) {
+            printf("MLX90393 %s (I2C%u, 0x%02X) initialized successfully!\n", dev->label, dev->bus, dev->addr);
         } else {
-            printf("Sensor not initialized\n");
+            printf("ERROR: MLX90393 %s (I2C%u, 0x%02X) initialization failed!\n", dev->label, dev->bus, dev->addr);
+            printf("Check I2C wiring and sensor power. Retrying in the background.\n");
         }
+        dev->up_reported = dev->initialized;
+    }
+    printf("\n");
+    
+    multicore_launch_core1(core1_main);
+    bool burst_requested = (acq_mode == ACQ_MODE_BURST);
+    acq_mode = (acq_mode_t)multicore_fifo_pop_blocking();
+    if (acq_mode == ACQ_MODE_BURST) {
+        printf("Burst mode active (DRDY interrupts)\n");
+    } else if (burst_requested) {
+        printf("ERROR: Burst mode failed, using single measurements\n");
+    }
+    
+    printf("Starting measurements...\n");
+    if (output_format == OUTPUT_FORMAT_BINARY) {
+        printf("Format: binary frames (%u bytes)\n\n", (unsigned)sizeof(sample_frame_t));
+    } else {
+        printf("Format: Z-axis(M1): X.XXX mT Force(M1): X.XXX N\n\n");
+    }
+    
+    bool led_state = false;
+    
+    // Main loop: filter and output whatever core1 has queued
+    while (true) {
+        command_poll();
+        output_poll();
         
-        sleep_ms(100);  // 10Hz sample rate
+        mlx_sample_t sample;
+        if (sample_ring_pop(&acq_ring, &sample)) {
+            // Toggle LED (kept off to save current in adaptive power mode)
+            if (!power.adaptive) {
+                gpio_put(LED_PIN, led_state);
+                led_state = !led_state;
+            }
+            process_sample(&sample);
+        } else {
+            cal_store_poll();
+            bool idle = true;
+            for (size_t i = 0; i < MLX_SENSOR_COUNT; i++) {
+                mlx_dev_t *dev = &mlx_devices[i];
+                if (dev->errors_reported != dev->errors) {
+                    dev->errors_reported = dev->errors;
+                    if (output_streaming) {
+                        output_flush();
+                        printf("Z-axis(%s): ERROR\n", dev->label);
+                    }
+                    idle = false;
+                }
+                if (dev->up_reported != dev->initialized) {
+                    dev->up_reported = dev->initialized;
+                    output_flush();
+                    if (dev->up_reported) {
+                        printf("Sensor %s recovered after %lu ms\n", dev->label, (unsigned long)dev->stats.recovery_last_ms);
+                    } else {
+                        printf("ERROR: sensor %s lost, reinitialising\n", dev->label);
+                    }
+                    idle = false;
+                }
+            }
+            if (idle && power.adaptive && !cmd_wait.active) {
+                __wfe();  // Core1's __sev(), USB or timer interrupt
+            } else if (idle) {
+                tight_loop_contents();
+            }
+        }
     }
     
     return 0;
 }
+#endif
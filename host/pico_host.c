@@ -0,0 +1,26 @@
+// Storage behind host/pico_host.h
+#include "pico_host.h"
+
+uint64_t host_time_us = 0;
+
+i2c_inst_t host_i2c[2] = {{0}, {1}};
+
+uint8_t host_flash[PICO_FLASH_SIZE_BYTES];
+
+void flash_range_erase(uint32_t flash_offs, size_t count) {
+    if (flash_offs < sizeof(host_flash) && count <= sizeof(host_flash) - flash_offs) {
+        memset(host_flash + flash_offs, 0xFF, count);
+    }
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count) {
+    if (flash_offs < sizeof(host_flash) && count <= sizeof(host_flash) - flash_offs) {
+        for (size_t i = 0; i < count; i++) host_flash[flash_offs + i] &= data[i];  // Programming only clears bits
+    }
+}
+
+static void host_out_chars(const char *buf, int len) {
+    fwrite(buf, 1, (size_t)len, stdout);
+}
+
+stdio_driver_t stdio_usb = {.out_chars = host_out_chars};
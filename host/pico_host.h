@@ -0,0 +1,125 @@
+// Host stand-in for the parts of the Pico SDK that force_sensor.c uses
+// outside its hardware-only sections (FORCE_SENSOR_HOST builds).
+//
+// Time is a replay clock: it only moves when a recorded sample sets it or
+// code sleeps, so a session replays as fast as the host can process it.
+// There is no sensor on the bus (I2C transfers fail), flash is a RAM image
+// and USB output goes to stdout.
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef unsigned int uint;
+
+#define count_of(a) (sizeof(a) / sizeof((a)[0]))
+
+#define PICO_OK 0
+#define PICO_ERROR_GENERIC -1
+#define PICO_ERROR_TIMEOUT -2
+
+// ========================================
+// TIME
+// ========================================
+extern uint64_t host_time_us;   // Replay clock, set by host_replay_sample()
+
+typedef uint64_t absolute_time_t;
+
+static inline uint64_t time_us_64(void) { return host_time_us; }
+static inline uint32_t time_us_32(void) { return (uint32_t)host_time_us; }
+static inline absolute_time_t get_absolute_time(void) { return host_time_us; }
+static inline absolute_time_t delayed_by_us(absolute_time_t t, uint64_t us) { return t + us; }
+static inline absolute_time_t make_timeout_time_us(uint64_t us) { return host_time_us + us; }
+static inline absolute_time_t make_timeout_time_ms(uint32_t ms) { return host_time_us + (uint64_t)ms * 1000; }
+static inline bool time_reached(absolute_time_t t) { return host_time_us >= t; }
+static inline int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to) { return (int64_t)(to - from); }
+static inline void sleep_until(absolute_time_t t) { if (t > host_time_us) host_time_us = t; }
+static inline void sleep_us(uint64_t us) { host_time_us += us; }
+static inline void sleep_ms(uint32_t ms) { host_time_us += (uint64_t)ms * 1000; }
+static inline void busy_wait_us(uint64_t us) { host_time_us += us; }
+static inline void busy_wait_us_32(uint32_t us) { host_time_us += us; }
+
+// ========================================
+// SYNC AND MULTICORE
+// ========================================
+// Single threaded: core1 does not exist, barriers and events are no-ops
+static inline void __dmb(void) {}
+static inline void __sev(void) {}
+static inline void __wfe(void) {}
+static inline void __wfi(void) {}
+static inline void tight_loop_contents(void) {}
+static inline uint32_t save_and_disable_interrupts(void) { return 0; }
+static inline void restore_interrupts(uint32_t status) { (void)status; }
+static inline void multicore_lockout_start_blocking(void) {}
+static inline void multicore_lockout_end_blocking(void) {}
+
+// ========================================
+// GPIO
+// ========================================
+#define GPIO_OUT 1
+#define GPIO_IN 0
+#define GPIO_IRQ_EDGE_RISE 0x8u
+
+static inline void gpio_init(unsigned gpio) { (void)gpio; }
+static inline void gpio_set_dir(unsigned gpio, bool out) { (void)gpio; (void)out; }
+static inline void gpio_put(unsigned gpio, bool value) { (void)gpio; (void)value; }
+static inline bool gpio_get(unsigned gpio) { (void)gpio; return false; }
+static inline void gpio_pull_up(unsigned gpio) { (void)gpio; }
+
+// ========================================
+// I2C
+// ========================================
+// No sensor: every transfer fails, so mlx_init() and friends report errors
+typedef struct {
+    int index;
+} i2c_inst_t;
+extern i2c_inst_t host_i2c[2];
+#define i2c0 (&host_i2c[0])
+#define i2c1 (&host_i2c[1])
+
+static inline int i2c_write_timeout_us(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, bool nostop, unsigned timeout_us) {
+    (void)i2c; (void)addr; (void)src; (void)len; (void)nostop; (void)timeout_us;
+    return PICO_ERROR_GENERIC;
+}
+static inline int i2c_read_timeout_us(i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len, bool nostop, unsigned timeout_us) {
+    (void)i2c; (void)addr; (void)dst; (void)len; (void)nostop; (void)timeout_us;
+    return PICO_ERROR_GENERIC;
+}
+
+// ========================================
+// FLASH
+// ========================================
+// A RAM image of just the calibration sector; replay.c erases it at start
+#define FLASH_PAGE_SIZE (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+#define PICO_FLASH_SIZE_BYTES FLASH_SECTOR_SIZE
+extern uint8_t host_flash[PICO_FLASH_SIZE_BYTES];
+#define XIP_BASE ((uintptr_t)host_flash)
+
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
+
+// ========================================
+// STDIO AND WATCHDOG
+// ========================================
+typedef struct {
+    void (*out_chars)(const char *buf, int len);
+} stdio_driver_t;
+extern stdio_driver_t stdio_usb;
+
+static inline bool stdio_usb_connected(void) { return true; }
+static inline int getchar_timeout_us(uint32_t timeout_us) { (void)timeout_us; return PICO_ERROR_TIMEOUT; }
+static inline bool watchdog_caused_reboot(void) { return false; }
+
+// ========================================
+// REPLAY ENTRY POINTS (force_sensor.c)
+// ========================================
+void host_replay_boot(void);
+size_t host_replay_sensor_count(void);
+void host_replay_sample_rate(uint8_t sensor, float hz);
+void host_replay_command(const char *text);
+void host_replay_sample(uint8_t sensor, uint64_t time_us, uint16_t seq, int16_t z, uint8_t status, uint8_t range);
+void host_replay_finish(void);
+uint16_t crc16_ccitt(const uint8_t *data, size_t len);
@@ -0,0 +1,333 @@
+// Host replay tool (force_replay): runs recorded sessions through the
+// core0 processing chain of force_sensor.c as fast as the host allows.
+//
+//   force_replay [-c cmd]... [-a cmd]... [-n repeat] file...
+//
+// file is a recorder.py log (.npy, recorded in binary format so it holds raw
+// counts) or a raw capture of the binary frame stream (anything else, e.g.
+// the serial port copied to a file). -c runs a command before the replay
+// (e.g. "filter 1 lowpass 20" or "format binary"), -a runs one afterwards
+// (e.g. "stats"), -n replays the files repeat times back to back. Firmware
+// output goes to stdout, the summary to stderr:
+//
+//   force_replay -n 100 session.npy > /dev/null
+//   perf record ./force_replay -c "filter 1 median 5" session.npy > /dev/null
+#define _POSIX_C_SOURCE 199309L     // clock_gettime()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "pico_host.h"
+
+#define REPLAY_MAX_COMMANDS 32
+#define REPLAY_START_US 1000000     // Device time of the first sample, the firmware reads 0 as "unset"
+
+#define NPY_MAGIC "\x93NUMPY"
+
+// sample_frame_t, see OUTPUT in force_sensor.c
+#define FRAME_SIZE 20
+#define FRAME_SYNC0 0xA5
+#define FRAME_SYNC1 0x5A
+#define FRAME_TYPE_SAMPLE 0x01
+
+typedef struct {
+    uint64_t time_us;
+    uint16_t seq;
+    int16_t z;
+    uint8_t status;
+    uint8_t sensor;
+    uint8_t range;
+} replay_sample_t;
+
+// pico_stream.SAMPLE_DTYPE fields the replay needs, located by name in the
+// .npy header's descr so added, dropped or reordered columns still load
+typedef struct {
+    const char *name;
+    const char *type;       // numpy kind and size, any little-endian byte order
+    size_t offset;
+    bool found;
+} npy_field_t;
+
+enum { NPY_TIME_US, NPY_TYPE, NPY_SENSOR, NPY_SEQ, NPY_RAW_Z, NPY_RANGE };
+
+typedef struct {
+    replay_sample_t *buf;
+    size_t count;
+    size_t capacity;
+} replay_log_t;
+
+static uint16_t get_u16(const uint8_t *p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+static uint32_t get_u32(const uint8_t *p) { return get_u16(p) | ((uint32_t)get_u16(p + 2) << 16); }
+static uint64_t get_u64(const uint8_t *p) { return get_u32(p) | ((uint64_t)get_u32(p + 4) << 32); }
+
+static const uint8_t *find_bytes(const uint8_t *data, size_t len, const char *needle) {
+    size_t n = strlen(needle);
+    for (size_t i = 0; i + n <= len; i++) {
+        if (memcmp(data + i, needle, n) == 0) return data + i;
+    }
+    return NULL;
+}
+
+static bool log_append(replay_log_t *log, const replay_sample_t *sample) {
+    if (log->count == log->capacity) {
+        size_t capacity = log->capacity ? 2 * log->capacity : 1 << 16;
+        replay_sample_t *buf = realloc(log->buf, capacity * sizeof(*buf));
+        if (!buf) return false;
+        log->buf = buf;
+        log->capacity = capacity;
+    }
+    log->buf[log->count++] = *sample;
+    return true;
+}
+
+static uint8_t *read_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    uint8_t *data = NULL;
+    if (fseek(f, 0, SEEK_END) == 0) {
+        long size = ftell(f);
+        if (size >= 0 && fseek(f, 0, SEEK_SET) == 0 && (data = malloc((size_t)size + 1))) {
+            *len = fread(data, 1, (size_t)size, f);
+            data[*len] = 0;     // Lets the .npy header be parsed as text
+        }
+    }
+    fclose(f);
+    return data;
+}
+
+/**
+ * Walk the structured descr of a .npy header, "[('name', '<f8'), ...]",
+ * filling in the offsets of the fields and returning the record size, or
+ * 0 for a layout this reader does not handle (big-endian, sub-arrays).
+ */
+static size_t npy_parse_descr(const char *descr, npy_field_t *fields, size_t field_count) {
+    size_t offset = 0;
+    const char *p = descr + strlen("'descr': [");
+    while (*p == '(') {
+        const char *name = p + 2;
+        const char *name_end = strchr(name, '\'');
+        if (p[1] != '\'' || !name_end || strncmp(name_end, "', '", 4) != 0) return 0;
+        const char *type = name_end + 4;
+        const char *type_end = strchr(type, '\'');
+        if (!type_end || type_end[1] != ')' || type_end - type < 3) return 0;
+        if (type[0] != '<' && type[0] != '|' && type[0] != '=') return 0;
+        size_t size = strtoul(type + 2, NULL, 10);
+        if (size == 0 || !strchr("biufV", type[1])) return 0;
+        
+        for (size_t i = 0; i < field_count; i++) {
+            if (strlen(fields[i].name) == (size_t)(name_end - name) && strncmp(fields[i].name, name, name_end - name) == 0 &&
+                strlen(fields[i].type) == (size_t)(type_end - type - 1) && strncmp(fields[i].type, type + 1, type_end - type - 1) == 0) {
+                fields[i].offset = offset;
+                fields[i].found = true;
+            }
+        }
+        offset += size;
+        p = type_end + 2;
+        if (strncmp(p, ", ", 2) == 0) p += 2;
+    }
+    return (*p == ']') ? offset : 0;
+}
+
+/**
+ * recorder.py log: a version 1 .npy of SAMPLE_DTYPE records. Text-format
+ * recordings have no raw counts (raw_z and range are 0) and are rejected.
+ * Only live samples are replayed; trigger event records are copies of them.
+ */
+static bool load_npy(const char *path, const uint8_t *data, size_t len, replay_log_t *log) {
+    if (len < 10 || memcmp(data, NPY_MAGIC, 6) != 0 || data[6] != 1) {
+        fprintf(stderr, "%s: not a version 1 .npy file\n", path);
+        return false;
+    }
+    size_t header_len = 10 + get_u16(data + 8);
+    npy_field_t fields[] = {
+        [NPY_TIME_US] = {"time_us", "i8"},
+        [NPY_TYPE] = {"type", "u1"},
+        [NPY_SENSOR] = {"sensor", "u1"},
+        [NPY_SEQ] = {"seq", "u2"},
+        [NPY_RAW_Z] = {"raw_z", "i2"},
+        [NPY_RANGE] = {"range", "u1"},
+    };
+    const char *descr = header_len <= len ? (const char *)find_bytes(data, header_len, "'descr': [") : NULL;
+    size_t record_size = descr ? npy_parse_descr(descr, fields, sizeof(fields) / sizeof(fields[0])) : 0;
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        if (!fields[i].found) record_size = 0;
+    }
+    if (record_size == 0 || find_bytes(data, header_len, "'fortran_order': True")) {
+        fprintf(stderr, "%s: not a recorder log (expected pico_stream.SAMPLE_DTYPE records)\n", path);
+        return false;
+    }
+    const char *shape = (const char *)find_bytes(data, header_len, "'shape': (");
+    size_t count = shape ? strtoull(shape + 10, NULL, 10) : 0;
+    if (count > (len - header_len) / record_size) count = (len - header_len) / record_size;
+    
+    bool raw = false;
+    for (size_t i = 0; i < count; i++) {
+        const uint8_t *r = data + header_len + i * record_size;
+        if (r[fields[NPY_TYPE].offset] != FRAME_TYPE_SAMPLE) continue;     // Events re-send earlier samples
+        replay_sample_t sample = {
+            .time_us = get_u64(r + fields[NPY_TIME_US].offset),
+            .seq = get_u16(r + fields[NPY_SEQ].offset),
+            .z = (int16_t)get_u16(r + fields[NPY_RAW_Z].offset),
+            .sensor = r[fields[NPY_SENSOR].offset],
+            .range = r[fields[NPY_RANGE].offset],
+        };
+        raw |= sample.z != 0 || sample.range != 0;
+        if (!log_append(log, &sample)) return false;
+    }
+    if (count > 0 && !raw) {
+        fprintf(stderr, "%s: no raw counts, record in binary format to replay\n", path);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Raw capture of the serial stream: sync on FRAME_SYNC0/1 and keep frames
+ * whose CRC matches, so text lines and replies in between are skipped. The
+ * 32-bit frame time of the live sample frames is unwrapped per sensor; event
+ * and history frames repeat older samples and are dropped.
+ */
+static bool load_frames(const uint8_t *data, size_t len, replay_log_t *log) {
+    uint32_t last_u32[256];
+    uint64_t wraps[256] = {0};
+    bool seen[256] = {false};
+    size_t i = 0;
+    while (i + FRAME_SIZE <= len) {
+        const uint8_t *f = data + i;
+        if (f[0] != FRAME_SYNC0 || f[1] != FRAME_SYNC1 || crc16_ccitt(f + 2, FRAME_SIZE - 4) != get_u16(f + FRAME_SIZE - 2)) {
+            i++;
+            continue;
+        }
+        i += FRAME_SIZE;
+        if (f[2] != FRAME_TYPE_SAMPLE) continue;     // Events re-send earlier samples, older than the last
+        uint8_t sensor = f[3];
+        uint32_t t = get_u32(f + 6);
+        if (seen[sensor] && t < last_u32[sensor]) wraps[sensor] += 1ull << 32;
+        seen[sensor] = true;
+        last_u32[sensor] = t;
+        replay_sample_t sample = {
+            .time_us = wraps[sensor] + t,
+            .seq = get_u16(f + 4),
+            .z = (int16_t)get_u16(f + 14),
+            .status = f[16],
+            .sensor = sensor,
+            .range = f[17],
+        };
+        if (!log_append(log, &sample)) return false;
+    }
+    return true;
+}
+
+static bool load_log(const char *path, replay_log_t *log) {
+    size_t len = 0;
+    uint8_t *data = read_file(path, &len);
+    if (!data) {
+        fprintf(stderr, "%s: cannot read\n", path);
+        return false;
+    }
+    size_t before = log->count;
+    bool ok = (len >= 6 && memcmp(data, NPY_MAGIC, 6) == 0) ? load_npy(path, data, len, log) : load_frames(data, len, log);
+    free(data);
+    if (!ok) return false;
+    fprintf(stderr, "%s: %zu samples\n", path, log->count - before);
+    
+    // Later files continue the clock 1 ms after the previous one ends
+    if (before > 0 && log->count > before) {
+        uint64_t offset_us = log->buf[before - 1].time_us + 1000 - log->buf[before].time_us;
+        for (size_t i = before; i < log->count; i++) log->buf[i].time_us += offset_us;
+    }
+    return true;
+}
+
+static double wall_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void usage() {
+    fprintf(stderr, "usage: force_replay [-c cmd]... [-a cmd]... [-n repeat] file...\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *before[REPLAY_MAX_COMMANDS];
+    const char *after[REPLAY_MAX_COMMANDS];
+    size_t before_count = 0;
+    size_t after_count = 0;
+    unsigned long repeat = 1;
+    replay_log_t log = {0};
+    bool have_file = false;
+    
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "-a") == 0) && i + 1 < argc) {
+            bool pre = argv[i][1] == 'c';
+            size_t *count = pre ? &before_count : &after_count;
+            if (*count == REPLAY_MAX_COMMANDS) usage();
+            (pre ? before : after)[(*count)++] = argv[++i];
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            repeat = strtoul(argv[++i], NULL, 10);
+            if (repeat < 1) usage();
+        } else if (argv[i][0] == '-') {
+            usage();
+        } else if (!load_log(argv[i], &log)) {
+            return 1;
+        } else {
+            have_file = true;
+        }
+    }
+    if (!have_file) usage();
+    if (log.count == 0) {
+        fprintf(stderr, "No samples to replay\n");
+        return 1;
+    }
+    
+    size_t sensors = host_replay_sensor_count();
+    host_time_us = REPLAY_START_US;
+    flash_range_erase(0, FLASH_SECTOR_SIZE);
+    host_replay_boot();
+    for (size_t n = 0; n < sensors; n++) {
+        size_t count = 0;
+        uint64_t first = 0;
+        uint64_t last = 0;
+        for (size_t i = 0; i < log.count; i++) {
+            if (log.buf[i].sensor != n) continue;
+            if (count++ == 0) first = log.buf[i].time_us;
+            last = log.buf[i].time_us;
+        }
+        if (count > 1 && last > first) host_replay_sample_rate((uint8_t)n, (count - 1) * 1e6f / (float)(last - first));
+    }
+    for (size_t i = 0; i < before_count; i++) host_replay_command(before[i]);
+    
+    // Each repeat continues the clock where the previous one ended
+    uint64_t first_us = log.buf[0].time_us;
+    uint64_t span_us = log.buf[log.count - 1].time_us - first_us;
+    uint64_t step_us = log.count > 1 ? span_us / (log.count - 1) : 1000;
+    size_t skipped = 0;
+    
+    double start = wall_s();
+    for (unsigned long r = 0; r < repeat; r++) {
+        uint64_t offset_us = REPLAY_START_US + r * (span_us + step_us) - first_us;
+        for (size_t i = 0; i < log.count; i++) {
+            const replay_sample_t *s = &log.buf[i];
+            if (s->sensor >= sensors) {
+                skipped++;
+                continue;
+            }
+            host_replay_sample(s->sensor, s->time_us + offset_us, s->seq, s->z, s->status, s->range);
+        }
+    }
+    host_replay_finish();
+    double took = wall_s() - start;
+    
+    for (size_t i = 0; i < after_count; i++) host_replay_command(after[i]);
+    host_replay_finish();
+    
+    size_t replayed = log.count * repeat - skipped;
+    double device_s = repeat * (span_us + step_us) / 1e6;
+    fprintf(stderr, "Replayed %zu samples (%.1f s of device time) in %.3f s: %.0f samples/s, %.0fx real time\n",
+            replayed, device_s, took, took > 0 ? replayed / took : 0.0, took > 0 ? device_s / took : 0.0);
+    if (skipped) fprintf(stderr, "Skipped %zu samples from sensors this build does not have\n", skipped);
+    free(log.buf);
+    return 0;
+}